@@ -0,0 +1,9 @@
+; recursion that is mostly tail calls, thousands of frames deep
+(def ack (m n)
+     (if (== m 0)
+         (+ n 1)
+         (if (== n 0)
+             (ack (- m 1) 1)
+             (ack (- m 1) (ack m (- n 1))))))
+
+(pr (ack 3 7) "\n")
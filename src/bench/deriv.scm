@@ -0,0 +1,34 @@
+; symbolic differentiation, builds and walks lots of small lists
+(def deriv (e)
+     (if (not (list? e))
+         (if (== e 'x) 1 0)
+         (if (== (car e) '+)
+             (cons '+ (deriv-all (cdr e)))
+             (if (== (car e) '-)
+                 (cons '- (deriv-all (cdr e)))
+                 (if (== (car e) '*)
+                     (list '* e (cons '+ (deriv-quotients (cdr e))))
+                     (if (== (car e) '/)
+                         (list '-
+                               (list '/ (deriv (car (cdr e))) (car (cdr (cdr e))))
+                               (list '/ (car (cdr e))
+                                     (list '* (car (cdr (cdr e))) (car (cdr (cdr e)))
+                                           (deriv (car (cdr (cdr e)))))))
+                         (pr "bad expression\n")))))))
+
+(def deriv-all (es)
+     (if (null? es)
+         es
+         (cons (deriv (car es)) (deriv-all (cdr es)))))
+
+(def deriv-quotients (es)
+     (if (null? es)
+         es
+         (cons (list '/ (deriv (car es)) (car es)) (deriv-quotients (cdr es)))))
+
+(def run (n last)
+     (if (== n 0)
+         last
+         (run (- n 1) (deriv '(+ (* 3 x x) (* a x x) (* b x) 5)))))
+
+(pr (len (run 20000 '())) "\n")
@@ -0,0 +1,7 @@
+; doubly recursive calls and fixnum arithmetic
+(def fib (n)
+     (if (< n 2)
+         n
+         (+ (fib (- n 1)) (fib (- n 2)))))
+
+(pr (fib 27) "\n")
@@ -0,0 +1,201 @@
+// runs each benchmark script through the interpreter a number of
+// times and reports the median and 95th percentile wall time and the
+// peak resident size, next to a saved baseline if there is one
+//
+// harness [--runs=n] [--baseline=file] [--save=file] [--flag=opt]... scheme file.scm...
+//
+// a script is fed to the interpreter on stdin with stdout thrown
+// away. anything on stderr means it went wrong, as the repl reports
+// errors there and carries on
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+    struct run {
+        double _ms;
+        long _rss_kb;
+        string _error; // empty if it went fine
+    };
+
+    struct result {
+        result() : _median(0), _p95(0), _rss_kb(0) {}
+        double _median;
+        double _p95;
+        long _rss_kb;
+    };
+
+    // one run of the interpreter on script
+    run run_once(const vector<string>& cmd, const string& script) {
+        run r = { 0, 0, "" };
+        int err[2];
+        if (pipe(err) != 0) {
+            r._error = "can't make a pipe";
+            return r;
+        }
+        const auto start = chrono::steady_clock::now();
+        const pid_t pid = fork();
+        if (pid == 0) {
+            const int in = open(script.c_str(), O_RDONLY);
+            const int out = open("/dev/null", O_WRONLY);
+            if (in < 0 || out < 0)
+                _exit(127);
+            dup2(in, 0);
+            dup2(out, 1);
+            dup2(err[1], 2);
+            close(err[0]);
+            vector<char*> argv;
+            for (auto& s : cmd)
+                argv.push_back(const_cast<char*>(s.c_str()));
+            argv.push_back(nullptr);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+        close(err[1]);
+        if (pid < 0) {
+            close(err[0]);
+            r._error = "can't fork";
+            return r;
+        }
+        char buf[4096];
+        for (ssize_t n; (n = read(err[0], buf, sizeof buf)) > 0; )
+            r._error.append(buf, n);
+        close(err[0]);
+
+        int status = 0;
+        rusage usage;
+        wait4(pid, &status, 0, &usage);
+        r._ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        r._rss_kb = usage.ru_maxrss;
+        if (r._error.empty() && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+            r._error = WIFSIGNALED(status) ? "killed by " + string(strsignal(WTERMSIG(status)))
+                                            : "exit status " + to_string(WEXITSTATUS(status));
+        return r;
+    }
+
+    // the first line of what went wrong
+    string first_line(const string& s) {
+        return s.substr(0, s.find('\n'));
+    }
+
+    string name_of(const string& script) {
+        string name = script.substr(script.rfind('/') + 1);
+        const size_t dot = name.rfind('.');
+        return dot == string::npos ? name : name.substr(0, dot);
+    }
+
+    // name median p95 rss per line
+    map<string, result> read_baseline(const string& fname) {
+        map<string, result> base;
+        ifstream f(fname.c_str());
+        string name;
+        result r;
+        while (f >> name >> r._median >> r._p95 >> r._rss_kb)
+            base[name] = r;
+        return base;
+    }
+
+    void usage(const char* self) {
+        cerr << "usage: " << self << " [--runs=n] [--baseline=file] [--save=file] [--flag=opt]... scheme file.scm..." << endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t runs = 10;
+    string baseline;
+    string save;
+    vector<string> cmd;
+
+    int arg = 1;
+    for (; arg < argc && string(argv[arg]).compare(0, 2, "--") == 0; ++arg) {
+        string opt(argv[arg]);
+        if (opt.compare(0, 7, "--runs=") == 0)
+            runs = max(strtoul(opt.c_str() + 7, nullptr, 10), 1ul);
+        else if (opt.compare(0, 11, "--baseline=") == 0)
+            baseline = opt.substr(11);
+        else if (opt.compare(0, 7, "--save=") == 0)
+            save = opt.substr(7);
+        else if (opt.compare(0, 7, "--flag=") == 0)
+            cmd.push_back(opt.substr(7));
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (arg + 1 >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    cmd.insert(cmd.begin(), argv[arg++]);
+
+    const map<string, result> base = baseline.empty() ? map<string, result>() : read_baseline(baseline);
+    map<string, result> results;
+    bool failed = false;
+
+    char line[160];
+    snprintf(line, sizeof line, "%-12s %10s %10s %10s", "", "median", "p95", "peak rss");
+    cout << line << (base.empty() ? "" : "   baseline   change") << "\n";
+
+    for (; arg < argc; ++arg) {
+        const string script = argv[arg];
+        const string name = name_of(script);
+        vector<double> times;
+        result r;
+        string error;
+        for (size_t i = 0; i < runs && error.empty(); ++i) {
+            const run one = run_once(cmd, script);
+            error = one._error;
+            times.push_back(one._ms);
+            r._rss_kb = max(r._rss_kb, one._rss_kb);
+        }
+        if (!error.empty()) {
+            cout << name << ": " << first_line(error) << endl;
+            failed = true;
+            continue;
+        }
+
+        sort(times.begin(), times.end());
+        const size_t n = times.size();
+        r._median = n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+        // nearest rank
+        r._p95 = times[(size_t)ceil(0.95 * n) - 1];
+        results[name] = r;
+
+        snprintf(line, sizeof line, "%-12s %8.1fms %8.1fms %8.1fMB",
+                 name.c_str(), r._median, r._p95, r._rss_kb / 1024.0);
+        cout << line;
+        auto b = base.find(name);
+        if (b != base.end()) {
+            snprintf(line, sizeof line, " %8.1fms %+7.1f%%",
+                     b->second._median, 100.0 * (r._median - b->second._median) / b->second._median);
+            cout << line;
+        }
+        cout << endl;
+    }
+
+    if (!save.empty()) {
+        ofstream f(save.c_str(), ios::trunc);
+        for (auto& i : results)
+            f << i.first << " " << i.second._median << " " << i.second._p95 << " " << i.second._rss_kb << "\n";
+        if (!f) {
+            cerr << "can't write " << save << endl;
+            return 1;
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+; expansion heavy: macros that expand into more macro calls
+(defmacro and
+  (fn (args ...)
+      (if (null? args)
+          t
+          (if (== (len args) 1)
+              (car args)
+              `(if ,(car args) (and ,@(cdr args)) f)))))
+
+(defmacro cond
+  (fn (args ...)
+      (if (null? args)
+          f
+          `(if ,(car args) ,(car (cdr args)) (cond ,@(cdr (cdr args)))))))
+
+; 2^n leaves, each one an and of a cond
+(defmacro tree
+  (fn (n)
+      (if (== n 0)
+          '(cond f 0 (and t t t t) 1 t 2)
+          `(+ (tree ,(- n 1)) (tree ,(- n 1))))))
+
+(: a (tree 12))
+(: b (tree 12))
+(: c (tree 12))
+(: d (tree 12))
+(pr (+ a b c d) "\n")
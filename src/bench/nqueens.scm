@@ -0,0 +1,31 @@
+; backtracking over lists, counts the solutions for 8 queens
+(def safe? (row dist placed)
+     (if (null? placed)
+         t
+         (if (== (car placed) row)
+             f
+             (if (== (- (car placed) row) dist)
+                 f
+                 (if (== (- row (car placed)) dist)
+                     f
+                     (safe? row (+ dist 1) (cdr placed)))))))
+
+(def try-rows (row n placed)
+     (if (> row n)
+         0
+         (+ (if (safe? row 1 placed)
+                (queens n (cons row placed))
+                0)
+            (try-rows (+ row 1) n placed))))
+
+(def queens (n placed)
+     (if (== (len placed) n)
+         1
+         (try-rows 1 n placed)))
+
+(def repeat (n)
+     (if (< n 2)
+         (queens 8 '())
+         (do (queens 8 '()) (repeat (- n 1)))))
+
+(pr (repeat 4) "\n")
@@ -0,0 +1,35 @@
+; merge sort of 20000 pseudo-random doubles
+(def numbers (i acc)
+     (if (== i 0)
+         acc
+         (numbers (- i 1) (cons (* 1000 (sin (* i 7))) acc))))
+
+; n may be a half, the first part gets the extra element
+(def take-half (lst n acc)
+     (if (< n 1)
+         (cons acc lst)
+         (take-half (cdr lst) (- n 1) (cons (car lst) acc))))
+
+(def merge (a b)
+     (if (null? a)
+         b
+         (if (null? b)
+             a
+             (if (< (car b) (car a))
+                 (cons (car b) (merge a (cdr b)))
+                 (cons (car a) (merge (cdr a) b))))))
+
+(def msort (lst)
+     (if (< (len lst) 2)
+         lst
+         (let (halves (take-half lst (/ (len lst) 2) '()))
+           (merge (msort (car halves)) (msort (cdr halves))))))
+
+(def sorted? (lst)
+     (if (null? (cdr lst))
+         t
+         (if (< (car (cdr lst)) (car lst))
+             f
+             (sorted? (cdr lst)))))
+
+(pr (sorted? (msort (numbers 20000 '()))) "\n")
@@ -0,0 +1,21 @@
+; makes many small strings and joins them pairwise into one
+(def pieces (i acc)
+     (if (== i 0)
+         acc
+         (pieces (- i 1) (cons (string-append "item-" (if (< i 50000) "a" "b") "-x;") acc))))
+
+; tail recursive, the jit runs deep recursion on the native stack
+(def join-pairs (lst acc)
+     (if (null? lst)
+         acc
+         (if (null? (cdr lst))
+             (cons (car lst) acc)
+             (join-pairs (cdr (cdr lst))
+                         (cons (string-append (car lst) (car (cdr lst))) acc)))))
+
+(def join (lst)
+     (if (null? (cdr lst))
+         (car lst)
+         (join (join-pairs lst '()))))
+
+(pr (len (join (pieces 100000 '()))) "\n")
@@ -0,0 +1,14 @@
+; deep non-tail recursion with three arguments
+(def tak (x y z)
+     (if (not (< y x))
+         z
+         (tak (tak (- x 1) y z)
+              (tak (- y 1) z x)
+              (tak (- z 1) x y))))
+
+(def repeat (n)
+     (if (< n 2)
+         (tak 18 12 6)
+         (do (tak 18 12 6) (repeat (- n 1)))))
+
+(pr (repeat 10) "\n")
@@ -0,0 +1,260 @@
+#include "f64vector.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define F64_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace std;
+
+namespace {
+    // each operation as a scalar function and, on x86-64, as sse2
+    // and avx2 intrinsics
+    struct add_op {
+        static double scalar(double a, double b) { return a + b; }
+#if defined(__x86_64__)
+        static __m128d sse(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+        F64_TARGET_AVX2 static __m256d avx(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+#endif
+    };
+
+    struct sub_op {
+        static double scalar(double a, double b) { return a - b; }
+#if defined(__x86_64__)
+        static __m128d sse(__m128d a, __m128d b) { return _mm_sub_pd(a, b); }
+        F64_TARGET_AVX2 static __m256d avx(__m256d a, __m256d b) { return _mm256_sub_pd(a, b); }
+#endif
+    };
+
+    struct mul_op {
+        static double scalar(double a, double b) { return a * b; }
+#if defined(__x86_64__)
+        static __m128d sse(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+        F64_TARGET_AVX2 static __m256d avx(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+#endif
+    };
+
+    struct div_op {
+        static double scalar(double a, double b) { return a / b; }
+#if defined(__x86_64__)
+        static __m128d sse(__m128d a, __m128d b) { return _mm_div_pd(a, b); }
+        F64_TARGET_AVX2 static __m256d avx(__m256d a, __m256d b) { return _mm256_div_pd(a, b); }
+#endif
+    };
+
+    // min and max keep a over a NaN b, as the instructions do
+    struct min_op {
+        static double scalar(double a, double b) { return b < a ? b : a; }
+#if defined(__x86_64__)
+        static __m128d sse(__m128d a, __m128d b) { return _mm_min_pd(b, a); }
+        F64_TARGET_AVX2 static __m256d avx(__m256d a, __m256d b) { return _mm256_min_pd(b, a); }
+#endif
+    };
+
+    struct max_op {
+        static double scalar(double a, double b) { return b > a ? b : a; }
+#if defined(__x86_64__)
+        static __m128d sse(__m128d a, __m128d b) { return _mm_max_pd(b, a); }
+        F64_TARGET_AVX2 static __m256d avx(__m256d a, __m256d b) { return _mm256_max_pd(b, a); }
+#endif
+    };
+
+    template <typename Op>
+    void map2_scalar(const double* a, const double* b, double* out, size_t n) {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = Op::scalar(a[i], b[i]);
+    }
+
+    // folds with four independent accumulators
+    template <typename Op>
+    double fold_scalar(const double* a, size_t n, double init) {
+        double acc[4] = { init, init, init, init };
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            for (int j = 0; j < 4; ++j)
+                acc[j] = Op::scalar(acc[j], a[i + j]);
+        for (; i < n; ++i)
+            acc[0] = Op::scalar(acc[0], a[i]);
+        return Op::scalar(Op::scalar(acc[0], acc[1]), Op::scalar(acc[2], acc[3]));
+    }
+
+#if defined(__x86_64__)
+    template <typename Op>
+    void map2_sse(const double* a, const double* b, double* out, size_t n) {
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(out + i, Op::sse(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        map2_scalar<Op>(a + i, b + i, out + i, n - i);
+    }
+
+    template <typename Op>
+    F64_TARGET_AVX2 void map2_avx(const double* a, const double* b, double* out, size_t n) {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(out + i, Op::avx(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        map2_scalar<Op>(a + i, b + i, out + i, n - i);
+    }
+
+    template <typename Op>
+    double fold_sse(const double* a, size_t n, double init) {
+        __m128d acc0 = _mm_set1_pd(init), acc1 = acc0;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc0 = Op::sse(acc0, _mm_loadu_pd(a + i));
+            acc1 = Op::sse(acc1, _mm_loadu_pd(a + i + 2));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, Op::sse(acc0, acc1));
+        double r = Op::scalar(lanes[0], lanes[1]);
+        for (; i < n; ++i)
+            r = Op::scalar(r, a[i]);
+        return r;
+    }
+
+    template <typename Op>
+    F64_TARGET_AVX2 double fold_avx(const double* a, size_t n, double init) {
+        __m256d acc0 = _mm256_set1_pd(init), acc1 = acc0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = Op::avx(acc0, _mm256_loadu_pd(a + i));
+            acc1 = Op::avx(acc1, _mm256_loadu_pd(a + i + 4));
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, Op::avx(acc0, acc1));
+        double r = Op::scalar(Op::scalar(lanes[0], lanes[1]), Op::scalar(lanes[2], lanes[3]));
+        for (; i < n; ++i)
+            r = Op::scalar(r, a[i]);
+        return r;
+    }
+
+    double dot_sse(const double* a, const double* b, size_t n) {
+        __m128d acc0 = _mm_setzero_pd(), acc1 = acc0;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+            acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+        double r = lanes[0] + lanes[1];
+        for (; i < n; ++i)
+            r += a[i] * b[i];
+        return r;
+    }
+
+    F64_TARGET_AVX2 double dot_avx(const double* a, const double* b, size_t n) {
+        __m256d acc0 = _mm256_setzero_pd(), acc1 = acc0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+            acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+        double r = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (; i < n; ++i)
+            r += a[i] * b[i];
+        return r;
+    }
+
+    enum kernels { Scalar, Sse2, Avx2 };
+
+    kernels pick_kernels() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? Avx2 : Sse2;
+    }
+
+    const kernels kernel_set = pick_kernels();
+
+    template <typename Op>
+    void map2(const double* a, const double* b, double* out, size_t n) {
+        if (kernel_set == Avx2)
+            map2_avx<Op>(a, b, out, n);
+        else
+            map2_sse<Op>(a, b, out, n);
+    }
+
+    template <typename Op>
+    double fold(const double* a, size_t n, double init) {
+        if (kernel_set == Avx2)
+            return fold_avx<Op>(a, n, init);
+        return fold_sse<Op>(a, n, init);
+    }
+
+    double dot(const double* a, const double* b, size_t n) {
+        if (kernel_set == Avx2)
+            return dot_avx(a, b, n);
+        return dot_sse(a, b, n);
+    }
+#else
+    double dot_scalar(const double* a, const double* b, size_t n) {
+        double acc[4] = { 0, 0, 0, 0 };
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            for (int j = 0; j < 4; ++j)
+                acc[j] += a[i + j] * b[i + j];
+        for (; i < n; ++i)
+            acc[0] += a[i] * b[i];
+        return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    }
+
+    enum kernels { Scalar };
+
+    const kernels kernel_set = Scalar;
+
+    template <typename Op>
+    void map2(const double* a, const double* b, double* out, size_t n) {
+        map2_scalar<Op>(a, b, out, n);
+    }
+
+    template <typename Op>
+    double fold(const double* a, size_t n, double init) {
+        return fold_scalar<Op>(a, n, init);
+    }
+
+    double dot(const double* a, const double* b, size_t n) {
+        return dot_scalar(a, b, n);
+    }
+#endif
+}
+
+void f64_add(const double* a, const double* b, double* out, size_t n) { map2<add_op>(a, b, out, n); }
+void f64_sub(const double* a, const double* b, double* out, size_t n) { map2<sub_op>(a, b, out, n); }
+void f64_mul(const double* a, const double* b, double* out, size_t n) { map2<mul_op>(a, b, out, n); }
+void f64_div(const double* a, const double* b, double* out, size_t n) { map2<div_op>(a, b, out, n); }
+
+void f64_scale(const double* a, double k, double* out, size_t n) {
+    // the same kernel as *, against a run of k
+    const size_t Chunk = 256;
+    double ks[Chunk];
+    for (size_t i = 0; i < Chunk; ++i)
+        ks[i] = k;
+    for (size_t i = 0; i < n; i += Chunk)
+        map2<mul_op>(a + i, ks, out + i, n - i < Chunk ? n - i : Chunk);
+}
+
+double f64_dot(const double* a, const double* b, size_t n) {
+    return dot(a, b, n);
+}
+
+double f64_sum(const double* a, size_t n) {
+    return fold<add_op>(a, n, 0.0);
+}
+
+double f64_min(const double* a, size_t n) {
+    return fold<min_op>(a, n, a[0]);
+}
+
+double f64_max(const double* a, size_t n) {
+    return fold<max_op>(a, n, a[0]);
+}
+
+const char* f64_kernels() {
+    switch (kernel_set) {
+#if defined(__x86_64__)
+    case Avx2: return "avx2";
+    case Sse2: return "sse2";
+#endif
+    default: return "scalar";
+    }
+}
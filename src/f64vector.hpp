@@ -0,0 +1,32 @@
+#pragma once
+
+// unboxed vectors of doubles, and the kernels that work on them a
+// whole array at a time. on x86-64 the kernels use avx2 if the cpu
+// has it and sse2 otherwise, elsewhere they are plain loops. sums
+// are accumulated in several lanes, so they can round differently
+// from adding the numbers up in order
+
+#include "scheme.hpp"
+
+struct f64vector {
+    std::vector<double> _data;
+};
+
+// out[i] = a[i] op b[i], out may be a or b
+void f64_add(const double* a, const double* b, double* out, size_t n);
+void f64_sub(const double* a, const double* b, double* out, size_t n);
+void f64_mul(const double* a, const double* b, double* out, size_t n);
+void f64_div(const double* a, const double* b, double* out, size_t n);
+
+// out[i] = a[i] * k
+void f64_scale(const double* a, double k, double* out, size_t n);
+
+double f64_dot(const double* a, const double* b, size_t n);
+double f64_sum(const double* a, size_t n);
+
+// n must be at least 1
+double f64_min(const double* a, size_t n);
+double f64_max(const double* a, size_t n);
+
+// the name of the kernels in use, "avx2", "sse2" or "scalar"
+const char* f64_kernels();
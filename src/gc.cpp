@@ -0,0 +1,271 @@
+#include "gc.hpp"
+
+#ifdef SCHEME_CELLGC
+
+#include "vm.hpp"
+#include "table.hpp"
+#include "interpreter.hpp"
+#include <unordered_set>
+#include <algorithm>
+#include <new>
+#include <type_traits>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+using namespace std;
+using namespace boost;
+
+namespace {
+    typedef sexpr_list::node node;
+    typedef std::aligned_storage<sizeof(node), alignof(node)>::type slot;
+
+    // blocks are aligned to their size, so the block of a node
+    // is found by masking its address
+    const size_t BlockBytes = 1 << 20;
+    const size_t MaxNodes = BlockBytes / sizeof(slot);
+    const size_t Words = (MaxNodes + 63) / 64;
+    const size_t MinHeap = 64*1024; // nodes before the first collection
+
+    struct block {
+        uint64_t _live[Words];
+        uint64_t _mark[Words];
+        slot _nodes[1];
+    };
+
+    const size_t Nodes = (BlockBytes - offsetof(block, _nodes)) / sizeof(slot);
+
+    inline block* block_of(const void* p) {
+        return (block*)((uintptr_t)p & ~(uintptr_t)(BlockBytes - 1));
+    }
+
+    inline size_t index_in(const block* b, const void* p) {
+        return (const slot*)p - b->_nodes;
+    }
+
+    inline bool test(const uint64_t* bits, size_t i) { return bits[i/64] & (1ull << (i%64)); }
+    inline void set(uint64_t* bits, size_t i) { bits[i/64] |= 1ull << (i%64); }
+    inline void clear(uint64_t* bits, size_t i) { bits[i/64] &= ~(1ull << (i%64)); }
+
+    struct heap {
+        heap() : _free(nullptr), _bump(nullptr), _top(0), _threshold(MinHeap) {
+            _stats._collections = 0;
+            _stats._allocated = 0;
+            _stats._live = 0;
+            _stats._capacity = 0;
+        }
+
+        void* alloc() {
+            void* p;
+            if (_free) {
+                p = _free;
+                _free = *(void**)p;
+            }
+            else {
+                if (!_bump || _top == Nodes)
+                    grow();
+                p = &_bump->_nodes[_top++];
+            }
+            block* b = block_of(p);
+            set(b->_live, index_in(b, p));
+            ++_stats._allocated;
+            ++_stats._live;
+            return p;
+        }
+
+        void free(void* p) {
+            block* b = block_of(p);
+            clear(b->_live, index_in(b, p));
+            *(void**)p = _free;
+            _free = p;
+            --_stats._live;
+        }
+
+        void grow() {
+            void* mem = nullptr;
+            if (posix_memalign(&mem, BlockBytes, BlockBytes) != 0)
+                throw bad_alloc();
+            block* b = (block*)mem;
+            fill(b->_live, b->_live + Words, 0);
+            fill(b->_mark, b->_mark + Words, 0);
+            _blocks.push_back(b);
+            _bump = b;
+            _top = 0;
+            _stats._capacity += Nodes;
+        }
+
+        // true if n wasn't marked before
+        bool mark(const node* n) {
+            block* b = block_of(n);
+            const size_t i = index_in(b, n);
+            if (test(b->_mark, i))
+                return false;
+            set(b->_mark, i);
+            return true;
+        }
+
+        void mark(const sexpr_list& l) {
+            for (const node* n = l._head.get(); n && mark(n); n = n->_cdr._head.get())
+                mark(n->_car);
+        }
+
+        void mark(const sexpr& x) {
+            if (auto l = get<sexpr_list>(&x))
+                mark(*l);
+            else if (auto p = get<procedure_ptr>(&x))
+                mark(*p);
+            else if (auto b = get<builtin>(&x)) {
+                if (const continuation* k = continuation_of(*b))
+                    mark(*k);
+            }
+            else if (auto t = get<table_ptr>(&x)) {
+                if (_seen.insert(t->get()).second)
+                    (*t)->each([this](const atom&, const sexpr& v) { mark(v); });
+            }
+            else if (auto v = get<vector_ptr>(&x)) {
+                if (_seen.insert(v->get()).second)
+                    for (auto& e : (*v)->_items)
+                        mark(e);
+            }
+        }
+
+        void mark(const continuation& k) {
+            if (!_seen.insert(&k).second)
+                return;
+            for (auto& x : k._stack)
+                mark(x);
+            for (auto& f : k._frames)
+                mark(f);
+            mark(k._resume);
+        }
+
+        void mark(const frame& f) {
+            mark(f._code);
+            mark(f._env);
+        }
+
+        void mark(const procedure_ptr& p) {
+            if (!_seen.insert(p.get()).second)
+                return;
+            mark(p->_names);
+            mark(p->_exp);
+            mark(p->_parent);
+            mark(p->_code);
+        }
+
+        void mark(const envptr& e) {
+            for (const environment* env = e.get(); env && _seen.insert(env).second; env = env->_parent.get()) {
+                mark(env->_names);
+                for (size_t i = 0; i < env->_names.size(); ++i)
+                    mark(env->_slots[i]);
+                for (auto& kv : env->_env)
+                    mark(kv.second._value);
+            }
+        }
+
+        void mark(const bytecode_ptr& bc) {
+            if (!bc || !_seen.insert(bc.get()).second)
+                return;
+            for (auto& x : bc->_consts)
+                mark(x);
+            for (auto& t : bc->_fns) {
+                mark(t._vars);
+                mark(t._names);
+                mark(t._exp);
+                mark(t._code);
+            }
+        }
+
+        // destroy the unmarked nodes, and give back blocks that
+        // end up empty
+        void sweep() {
+            _free = nullptr;
+            _stats._live = 0;
+            vector<block*> kept;
+            for (block* b : _blocks) {
+                const size_t n = (b == _bump) ? _top : Nodes;
+                size_t live = 0;
+                void* free = _free;
+                for (size_t i = 0; i < n; ++i) {
+                    if (test(b->_mark, i)) {
+                        ++live;
+                        continue;
+                    }
+                    if (test(b->_live, i)) {
+                        ((node*)&b->_nodes[i])->~node();
+                        clear(b->_live, i);
+                    }
+                    *(void**)&b->_nodes[i] = free;
+                    free = &b->_nodes[i];
+                }
+                fill(b->_mark, b->_mark + Words, 0);
+                if (live == 0 && b != _bump) {
+                    ::free(b);
+                    _stats._capacity -= Nodes;
+                    continue;
+                }
+                _free = free;
+                _stats._live += live;
+                kept.push_back(b);
+            }
+            _blocks.swap(kept);
+        }
+
+        void collect() {
+            if (interpreter::current)
+                mark(interpreter::current->_globals);
+            for (const sexpr* x : _roots)
+                mark(*x);
+            _seen.clear();
+            sweep();
+            ++_stats._collections;
+            _threshold = max(MinHeap, 2*_stats._live);
+        }
+
+        vector<block*> _blocks;
+        void* _free;    // dead nodes, linked through their storage
+        block* _bump;   // the newest block, allocated from [_top, Nodes)
+        size_t _top;
+        size_t _threshold;
+        unordered_set<const sexpr*> _roots;
+        unordered_set<const void*> _seen; // procedures, frames and code marked so far
+        gc_stats _stats;
+    };
+
+    heap& the_heap() {
+        static heap h;
+        return h;
+    }
+}
+
+void* util::node_alloc(size_t size) {
+    return the_heap().alloc();
+}
+
+void util::node_free(void* p) {
+    the_heap().free(p);
+}
+
+void gc_addroot(const sexpr* x) {
+    the_heap()._roots.insert(x);
+}
+
+void gc_rmroot(const sexpr* x) {
+    the_heap()._roots.erase(x);
+}
+
+void gc_safepoint() {
+    heap& h = the_heap();
+    if (h._stats._live >= h._threshold)
+        h.collect();
+}
+
+void gc_collect() {
+    the_heap().collect();
+}
+
+const gc_stats& gc_statistics() {
+    return the_heap()._stats;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+// the traced heap that holds list nodes when built with
+// -DSCHEME_CELLGC: nodes are fixed size, bump allocated from large
+// blocks and reclaimed by mark and sweep instead of reference counts
+//
+// values on the C++ stack aren't visible to the collector, so it
+// only runs at safe points where every live list is reachable from
+// the globals of the interpreter, its macros or an explicit root
+
+#include "scheme.hpp"
+
+#ifdef SCHEME_CELLGC
+
+struct gc_stats {
+    size_t _collections;
+    size_t _allocated; // nodes allocated in total
+    size_t _live;      // nodes in use
+    size_t _capacity;  // nodes the heap has room for
+};
+
+void gc_addroot(const sexpr* x);
+void gc_rmroot(const sexpr* x);
+
+// collect if the heap has grown enough since the last collection
+void gc_safepoint();
+void gc_collect();
+
+const gc_stats& gc_statistics();
+
+#else
+
+inline void gc_addroot(const sexpr* x) {}
+inline void gc_rmroot(const sexpr* x) {}
+inline void gc_safepoint() {}
+inline void gc_collect() {}
+
+#endif
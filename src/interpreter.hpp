@@ -0,0 +1,122 @@
+#pragma once
+
+// the state of one interpreter: its global environment with the
+// builtins bound in it, its macros, the options it runs with and the
+// stacks its calls use. a process can hold any number of them, each
+// running on its own thread, which makes it current with an
+// interpreter::scope for as long as it runs it
+//
+// values can't be passed from one interpreter to another, since
+// lists and frames are reference counted without atomics
+//
+// with SCHEME_CELLGC there's a single traced heap that isn't thread
+// safe, so there can only be one interpreter at a time
+
+#include "scheme.hpp"
+#include "optimize.hpp"
+#include <istream>
+#include <map>
+#include <string>
+
+enum engine_type { TreeWalker, Bytecode };
+
+// storage for the frames of procedures that don't escape. a frame
+// is dead once nothing refers to it, and dead frames are popped
+// off the top, so frames of calls that have returned are reused
+// right away. the memory is reserved up front and never moves
+class frame_stack {
+public:
+    explicit frame_stack(size_t bytes)
+        : _base((char*)::operator new(bytes)), _top(_base), _end(_base + bytes),
+          _last(0) {
+    }
+    ~frame_stack() {
+        ::operator delete(_base);
+    }
+
+    // null if there's no room left
+    void* alloc(size_t bytes) {
+        if ((size_t)(_end - _top) < bytes)
+            return 0;
+        void* p = _top;
+        _top += bytes;
+        return p;
+    }
+
+    void push(environment* e) {
+        e->_below = _last;
+        _last = e;
+    }
+
+    // in scheme.cpp
+    void pop_dead();
+
+private:
+    frame_stack(const frame_stack&);
+    frame_stack& operator=(const frame_stack&);
+
+    char* _base;
+    char* _top;
+    char* _end;
+    environment* _last; // the topmost frame
+};
+
+struct interpreter {
+    // a fresh global environment with the builtins, in scheme.cpp
+    interpreter();
+    ~interpreter();
+
+    // runs the forms of text with this as the current interpreter,
+    // the value of the last one, errors are passed on
+    sexpr evaluate(const std::string& text);
+
+    // reads and runs the forms of src as the repl does, reporting
+    // errors on cerr and printing values to cout if print is set
+    void run(std::istream& src, bool print);
+
+    // makes an interpreter the current one of this thread
+    struct scope {
+        explicit scope(interpreter& in) : _outer(current) {
+            current = &in;
+        }
+        ~scope() {
+            current = _outer;
+        }
+        interpreter* _outer;
+    };
+
+    engine_type _engine;
+    unsigned _jit_threshold; // calls before a body gets compiled, 0 turns the jit off
+    bool _optimizing;
+    bool _use_load_cache;
+    size_t _max_depth; // see check_depth()
+    size_t _deepest;
+
+    // declared before the values, which may hold frames on them
+    frame_stack _frames;
+    arg_stack _args;
+
+    envptr _globals;
+    std::map<symbol, sexpr> _macros;
+    unsigned _macro_definitions; // defmacros expanded so far
+    inlinable_map _inlinables;   // of optimize()
+
+    static thread_local interpreter* current;
+
+private:
+    interpreter(const interpreter&);
+    interpreter& operator=(const interpreter&);
+};
+
+// how many pending continuation frames eval and the vm may hold
+// before giving up with "recursion too deep", 0 for no limit, and
+// the most either has held so far
+inline
+void check_depth(size_t depth) {
+    interpreter& in = *interpreter::current;
+    if (depth > in._deepest) {
+        in._deepest = depth;
+        if (in._max_depth && depth > in._max_depth)
+            throw std::runtime_error("recursion too deep");
+    }
+}
@@ -30,8 +30,8 @@ namespace util {
                 T* tmp = _ptr;
                 _ptr = p._ptr;
                 p._ptr = 0;
-                if (tmp && (tmp == _ptr))
-                    decref(_ptr);
+                if (tmp)
+                    decref(tmp);
             }
             return *this;
         }
@@ -0,0 +1,689 @@
+#include "jit.hpp"
+#include "profiler.hpp"
+#include "interpreter.hpp"
+#include <exception>
+#include <iterator>
+#include <map>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+using namespace boost;
+
+// state shared by the native code running on a thread, rbx points
+// here while it runs
+struct jitctx {
+    jitctx() : _nargs(0), _x(0), _y(0), _i(0), _j(0) {}
+    sexprs _stack;
+    envptr _env;
+    size_t _nargs; // argument count of a pending tail call
+    double _x;     // unboxed operands of inlined arithmetic
+    double _y;
+    fixnum _i;     // or fixnum ones
+    fixnum _j;
+    exception_ptr _error;
+};
+
+namespace {
+
+    thread_local jitctx ctx;
+
+    // native code returns one of these
+    enum { Done = 0, TailCall = 1, Failed = 2 };
+
+    // the helpers called from native code must not let exceptions
+    // unwind through it, so they park them in _error instead
+    template <typename Fn>
+    int guarded(jitctx* c, const Fn& fn) {
+        try {
+            fn();
+            return Done;
+        }
+        catch (...) {
+            c->_error = current_exception();
+            return Failed;
+        }
+    }
+
+    int invoke(jitctx* c, procedure_ptr proc, sexprs& args);
+
+    int jit_push(jitctx* c, const sexpr* x) {
+        return guarded(c, [=] { c->_stack.push_back(*x); });
+    }
+
+    int jit_local(jitctx* c, size_t depth, size_t index) {
+        return guarded(c, [=] { c->_stack.push_back(c->_env->slot(depth, index)); });
+    }
+
+    int jit_global(jitctx* c, const globalref* g) {
+        return guarded(c, [=] { c->_stack.push_back(global_value(*g)); });
+    }
+
+    int jit_name(jitctx* c, const sexpr* name) {
+        return guarded(c, [=] { c->_stack.push_back(c->_env->find(*name)[*name]); });
+    }
+
+    int jit_set_local(jitctx* c, size_t depth, size_t index) {
+        return guarded(c, [=] {
+                c->_env->slot(depth, index) = c->_stack.back();
+                c->_stack.pop_back();
+            });
+    }
+
+    int jit_set_global(jitctx* c, const globalref* g) {
+        return guarded(c, [=] {
+                global_value(*g) = std::move(c->_stack.back());
+                c->_stack.pop_back();
+            });
+    }
+
+    int jit_set_name(jitctx* c, const sexpr* name) {
+        return guarded(c, [=] {
+                c->_env->find(*name)[*name] = c->_stack.back();
+                c->_stack.pop_back();
+            });
+    }
+
+    int jit_def_name(jitctx* c, const sexpr* name) {
+        return guarded(c, [=] {
+                (*c->_env)[*name] = c->_stack.back();
+                c->_stack.pop_back();
+            });
+    }
+
+    int jit_pop(jitctx* c) {
+        c->_stack.pop_back();
+        return Done;
+    }
+
+    int jit_truth(jitctx* c) {
+        const bool t = truth(c->_stack.back());
+        c->_stack.pop_back();
+        return t;
+    }
+
+    int jit_closure(jitctx* c, const fntemplate* t) {
+        return guarded(c, [=] {
+                procedure_ptr p(new procedure(t->_vars, t->_exp, c->_env, t->_names, t->_escapes, t->_name));
+                p->_code = t->_code;
+                c->_stack.push_back(p);
+            });
+    }
+
+    // the arguments are moved off _stack first, since a builtin
+    // that calls back into the jit could reallocate it. kept out of
+    // jit_call so that recursion through it doesn't pay for the frame
+    __attribute__((noinline))
+    void call_builtin(jitctx* c, sexprs::iterator first) {
+        const builtin fn = get<builtin>(*(first - 1));
+        arg_frame frame(c->_stack.end() - first);
+        for (auto i = first; i != c->_stack.end(); ++i)
+            frame.push(std::move(*i));
+        c->_stack.erase(first - 1, c->_stack.end());
+        c->_stack.push_back(fn(frame.args()));
+    }
+
+    int jit_call(jitctx* c, size_t n) {
+        procedure_ptr proc;
+        sexprs args;
+        int st = guarded(c, [&] {
+                auto first = c->_stack.end() - n;
+                if (get<builtin>(&*(first - 1))) {
+                    call_builtin(c, first);
+                }
+                else if (auto p = get<procedure_ptr>(&*(first - 1))) {
+                    args.assign(std::make_move_iterator(first),
+                                std::make_move_iterator(c->_stack.end()));
+                    proc = *p;
+                    c->_stack.erase(first - 1, c->_stack.end());
+                    if (!proc->_code)
+                        proc->_code = compile(proc->_exp);
+                    if (!jit_hot(*proc->_code)) {
+                        c->_stack.push_back(vm_apply(proc, args));
+                        proc.reset();
+                    }
+                }
+                else {
+                    throw runtime_error("not callable");
+                }
+            });
+        if (st == Done && proc)
+            return invoke(c, proc, args);
+        return st;
+    }
+
+    // slow path of inlined arithmetic: look the builtin up and call it
+    int jit_call_global(jitctx* c, const globalref* g, size_t n) {
+        int st = guarded(c, [=] {
+                c->_stack.insert(c->_stack.end() - n, global_value(*g));
+            });
+        if (st == Done)
+            return jit_call(c, n);
+        return st;
+    }
+
+    enum { Slow = 0, Doubles = 1, Fixnums = 2 };
+
+    // fast path check of inlined arithmetic: the global still holds
+    // the primitive and both operands are numbers. pops them into
+    // _i and _j if both are fixnums, or into _x and _y as doubles.
+    // fixnum division goes the slow way to stay exact
+    int jit_unbox2(jitctx* c, const globalref* g, size_t prim) {
+        const global_cell* cell = g->_cell;
+        if (!cell->_bound || primitive_of(cell->_value) != (primitive)prim)
+            return Slow;
+        const size_t n = c->_stack.size();
+        const atom* x = get<atom>(&c->_stack[n-2]);
+        const atom* y = get<atom>(&c->_stack[n-1]);
+        if (!x || !y)
+            return Slow;
+        const fixnum* i0 = get<fixnum>(x);
+        const fixnum* i1 = get<fixnum>(y);
+        int st;
+        if (i0 && i1) {
+            if (prim == PrimDiv)
+                return Slow;
+            c->_i = *i0;
+            c->_j = *i1;
+            st = Fixnums;
+        }
+        else {
+            const double* d0 = get<double>(x);
+            const double* d1 = get<double>(y);
+            if (!(d0 || i0) || !(d1 || i1))
+                return Slow;
+            c->_x = d0 ? *d0 : (double)*i0;
+            c->_y = d1 ? *d1 : (double)*i1;
+            st = Doubles;
+        }
+        c->_stack.pop_back();
+        c->_stack.pop_back();
+        return st;
+    }
+
+    int jit_push_double(jitctx* c, double d) {
+        return guarded(c, [=] { c->_stack.push_back(atom(d)); });
+    }
+
+    int jit_push_fixnum(jitctx* c, fixnum i) {
+        return guarded(c, [=] { c->_stack.push_back(atom(i)); });
+    }
+
+    // fixnum arithmetic that overflowed, redone in double
+    int jit_push_overflow(jitctx* c, size_t prim) {
+        const double x = (double)c->_i;
+        const double y = (double)c->_j;
+        switch (prim) {
+        case PrimAdd: return jit_push_double(c, x + y);
+        case PrimSub: return jit_push_double(c, x - y);
+        default: return jit_push_double(c, x * y);
+        }
+    }
+
+    int jit_push_bool(jitctx* c, size_t b) {
+        return guarded(c, [=] {
+                if (b)
+                    c->_stack.push_back(atom(symbol(SymT)));
+                else
+                    c->_stack.push_back(sexpr_list());
+            });
+    }
+
+    // run proc natively, following tail calls, and push its value
+    // what the profiler sees of an invoke(), its one frame
+    void walk_invoke(const void* state, vector<const environment*>& frames) {
+        frames.push_back(*(const environment* const*)state);
+    }
+
+    int invoke(jitctx* c, procedure_ptr proc, sexprs& args) {
+        const size_t base = c->_stack.size();
+        envptr saved = std::move(c->_env);
+        const environment* frame = nullptr;
+        profiled_run profiled(walk_invoke, &frame);
+        int st = Done;
+        try {
+            while (true) {
+                c->_env = envptr();
+                c->_env = make_frame(*proc, args.data(), args.size());
+                frame = c->_env.get();
+                if (profile_due)
+                    profile_sample();
+                st = proc->_code->_native(c);
+                if (st != TailCall)
+                    break;
+                const size_t n = c->_nargs;
+                auto first = c->_stack.end() - n;
+                sexpr callee = std::move(*(first - 1));
+                args.assign(std::make_move_iterator(first),
+                            std::make_move_iterator(c->_stack.end()));
+                c->_stack.erase(first - 1, c->_stack.end());
+                st = Done;
+                if (auto l = get<builtin>(&callee)) {
+                    c->_stack.push_back((*l)(args));
+                    break;
+                }
+                else if (auto p = get<procedure_ptr>(&callee)) {
+                    proc = *p;
+                    if (!proc->_code)
+                        proc->_code = compile(proc->_exp);
+                    if (jit_hot(*proc->_code))
+                        continue;
+                    c->_stack.push_back(vm_apply(proc, args));
+                    break;
+                }
+                else {
+                    throw runtime_error("not callable");
+                }
+            }
+        }
+        catch (...) {
+            c->_error = current_exception();
+            st = Failed;
+        }
+        c->_env = std::move(saved);
+        if (st == Failed)
+            c->_stack.erase(c->_stack.begin() + base, c->_stack.end());
+        return st;
+    }
+
+#if defined(__x86_64__)
+
+    struct assembler {
+        void byte(uint8_t b) { _buf.push_back(b); }
+        void bytes(std::initializer_list<uint8_t> bs) { _buf.insert(_buf.end(), bs); }
+        void dword(uint32_t d) { for (int i = 0; i < 4; ++i) byte(d >> (8*i)); }
+        void qword(uint64_t q) { for (int i = 0; i < 8; ++i) byte(q >> (8*i)); }
+        size_t here() const { return _buf.size(); }
+
+        // rdi = ctx, as the first argument of every helper
+        void ctx_arg() { bytes({0x48, 0x89, 0xdf}); }            // mov rdi, rbx
+        void arg2(uint64_t v) { bytes({0x48, 0xbe}); qword(v); } // mov rsi, imm64
+        void arg3(uint64_t v) { bytes({0x48, 0xba}); qword(v); } // mov rdx, imm64
+        template <typename Fn>
+        void call(Fn* fn) {
+            bytes({0x48, 0xb8});                                 // mov rax, imm64
+            qword((uint64_t)(uintptr_t)fn);
+            bytes({0xff, 0xd0});                                 // call rax
+        }
+        void test_eax() { bytes({0x85, 0xc0}); }
+        // jcc/jmp rel32, returns the position of the displacement
+        size_t jcc(uint8_t cc) { bytes({0x0f, cc}); dword(0); return here() - 4; }
+        size_t jmp() { byte(0xe9); dword(0); return here() - 4; }
+        void patch(size_t at, size_t target) {
+            int32_t rel = (int32_t)(target - (at + 4));
+            memcpy(&_buf[at], &rel, 4);
+        }
+        void ret(uint32_t status) {
+            byte(0xb8); dword(status);                           // mov eax, status
+            bytes({0x5b, 0xc3});                                 // pop rbx; ret
+        }
+        // movsd xmm<reg>, [rbx+disp]
+        void load_double(uint8_t reg, uint32_t disp) {
+            bytes({0xf2, 0x0f, 0x10, (uint8_t)(0x83 | (reg << 3))});
+            dword(disp);
+        }
+        // mov r<reg>, [rbx+disp], for rax/rcx/rdx/rbx
+        void load_qword(uint8_t reg, uint32_t disp) {
+            bytes({0x48, 0x8b, (uint8_t)(0x83 | (reg << 3))});
+            dword(disp);
+        }
+        vector<uint8_t> _buf;
+    };
+
+    enum { Jo = 0x80, Je = 0x84, Jz = 0x84, Jnz = 0x85, Jbe = 0x86,
+           Jge = 0x8d, Jle = 0x8e };
+
+    primitive primitive_named(const string& name) {
+        if (name == "+") return PrimAdd;
+        if (name == "-") return PrimSub;
+        if (name == "*") return PrimMul;
+        if (name == "/") return PrimDiv;
+        if (name == "<") return PrimLt;
+        if (name == ">") return PrimGt;
+        return PrimNone;
+    }
+
+    const globalref* global_at(const bytecode& bc, uint32_t w) {
+        return &get<globalref>(bc._consts[arg_of(w)]);
+    }
+
+    // which instruction pushed the callee of each call, by
+    // following the stack effect of the code. -1 where unknown
+    bool find_callees(const bytecode& bc, vector<int>& callee) {
+        const vector<uint32_t>& code = bc._code;
+        map<size_t, vector<int>> states;
+        vector<int> sim;
+        bool live = true;
+        auto merge = [&](vector<int>& into, const vector<int>& from) {
+            if (into.size() != from.size())
+                return false;
+            for (size_t k = 0; k < into.size(); ++k)
+                if (into[k] != from[k])
+                    into[k] = -1;
+            return true;
+        };
+        auto jump = [&](size_t target) {
+            auto st = states.find(target);
+            if (st == states.end()) {
+                states[target] = sim;
+                return true;
+            }
+            return merge(st->second, sim);
+        };
+        callee.assign(code.size(), -1);
+        for (size_t i = 0; i < code.size(); ++i) {
+            auto st = states.find(i);
+            if (st != states.end()) {
+                if (!live)
+                    sim = st->second;
+                else if (!merge(sim, st->second))
+                    return false;
+                live = true;
+            }
+            if (!live)
+                continue;
+            const uint32_t w = code[i];
+            switch (op_of(w)) {
+            case OpConst: case OpLocal: case OpGlobal: case OpName: case OpClosure:
+                sim.push_back(i);
+                break;
+            case OpSetLocal: case OpSetGlobal: case OpSetName: case OpDefName: case OpPop:
+                sim.pop_back();
+                break;
+            case OpJump:
+                if (!jump(arg_of(w)))
+                    return false;
+                live = false;
+                break;
+            case OpJumpIfNot:
+                sim.pop_back();
+                if (!jump(arg_of(w)))
+                    return false;
+                break;
+            case OpCall:
+            case OpTailCall: {
+                const size_t n = arg_of(w);
+                callee[i] = sim[sim.size() - n - 1];
+                sim.resize(sim.size() - n - 1);
+                if (op_of(w) == OpCall)
+                    sim.push_back(i);
+                else
+                    live = false;
+                break;
+            }
+            case OpReturn:
+                live = false;
+                break;
+            }
+        }
+        return true;
+    }
+
+    // native code keeps its frames on the C++ stack, where call/cc
+    // can't capture them, so code that may call it stays in the vm
+    bool calls_callcc(const bytecode& bc) {
+        for (uint32_t w : bc._code)
+            if (op_of(w) == OpGlobal && global_at(bc, w)->_name == symbol("call/cc"))
+                return true;
+        return false;
+    }
+
+    void jit_compile(bytecode& bc) {
+        const vector<uint32_t>& code = bc._code;
+
+        vector<int> callee;
+        if (!find_callees(bc, callee) || calls_callcc(bc))
+            return;
+        vector<bool> target(code.size() + 1, false);
+        vector<bool> elided(code.size(), false);
+        vector<primitive> prim(code.size(), PrimNone);
+        for (size_t i = 0; i < code.size(); ++i) {
+            const uint32_t w = code[i];
+            if (op_of(w) == OpJump || op_of(w) == OpJumpIfNot)
+                target[arg_of(w)] = true;
+            if ((op_of(w) == OpCall || op_of(w) == OpTailCall) &&
+                arg_of(w) == 2 && callee[i] >= 0 &&
+                op_of(code[callee[i]]) == OpGlobal) {
+                prim[i] = primitive_named(global_at(bc, code[callee[i]])->_name.str());
+                if (prim[i] != PrimNone)
+                    elided[callee[i]] = true;
+            }
+        }
+
+        const uint32_t nargs_off = (char*)&ctx._nargs - (char*)&ctx;
+        const uint32_t x_off = (char*)&ctx._x - (char*)&ctx;
+        const uint32_t y_off = (char*)&ctx._y - (char*)&ctx;
+        const uint32_t i_off = (char*)&ctx._i - (char*)&ctx;
+        const uint32_t j_off = (char*)&ctx._j - (char*)&ctx;
+
+        assembler a;
+        vector<size_t> offset(code.size(), 0);
+        vector<pair<size_t, size_t>> jumps; // displacement, bytecode target
+        vector<size_t> failed;              // displacements to the error exit
+        auto check = [&] {
+            a.test_eax();
+            failed.push_back(a.jcc(Jnz));
+        };
+
+        a.byte(0x53);                        // push rbx
+        a.bytes({0x48, 0x89, 0xfb});         // mov rbx, rdi
+
+        for (size_t i = 0; i < code.size(); ++i) {
+            offset[i] = a.here();
+            const uint32_t w = code[i];
+            switch (op_of(w)) {
+            case OpConst:
+                a.ctx_arg(); a.arg2((uintptr_t)&bc._consts[arg_of(w)]);
+                a.call(jit_push); check();
+                break;
+            case OpLocal:
+                a.ctx_arg(); a.arg2(frame_depth(w)); a.arg3(frame_slot(w));
+                a.call(jit_local); check();
+                break;
+            case OpGlobal:
+                if (elided[i])
+                    break;
+                a.ctx_arg(); a.arg2((uintptr_t)global_at(bc, w));
+                a.call(jit_global); check();
+                break;
+            case OpName:
+                a.ctx_arg(); a.arg2((uintptr_t)&bc._consts[arg_of(w)]);
+                a.call(jit_name); check();
+                break;
+            case OpSetLocal:
+                a.ctx_arg(); a.arg2(frame_depth(w)); a.arg3(frame_slot(w));
+                a.call(jit_set_local); check();
+                break;
+            case OpSetGlobal:
+                a.ctx_arg(); a.arg2((uintptr_t)global_at(bc, w));
+                a.call(jit_set_global); check();
+                break;
+            case OpSetName:
+                a.ctx_arg(); a.arg2((uintptr_t)&bc._consts[arg_of(w)]);
+                a.call(jit_set_name); check();
+                break;
+            case OpDefName:
+                a.ctx_arg(); a.arg2((uintptr_t)&bc._consts[arg_of(w)]);
+                a.call(jit_def_name); check();
+                break;
+            case OpPop:
+                a.ctx_arg(); a.call(jit_pop);
+                break;
+            case OpJump:
+                jumps.push_back(make_pair(a.jmp(), arg_of(w)));
+                break;
+            case OpJumpIfNot:
+                a.ctx_arg(); a.call(jit_truth);
+                a.test_eax();
+                jumps.push_back(make_pair(a.jcc(Jz), arg_of(w)));
+                break;
+            case OpClosure:
+                a.ctx_arg(); a.arg2((uintptr_t)&bc._fns[arg_of(w)]);
+                a.call(jit_closure); check();
+                break;
+            case OpCall:
+            case OpTailCall:
+                if (prim[i] != PrimNone) {
+                    const globalref* name = global_at(bc, code[callee[i]]);
+                    const bool compare = prim[i] == PrimLt || prim[i] == PrimGt;
+                    // (if (< a b) ...) branches on the flags directly
+                    const bool fused = compare && op_of(w) == OpCall &&
+                        i + 1 < code.size() && op_of(code[i+1]) == OpJumpIfNot &&
+                        !target[i+1];
+                    a.ctx_arg(); a.arg2((uintptr_t)name); a.arg3(prim[i]);
+                    a.call(jit_unbox2);
+                    a.test_eax();
+                    size_t slow = a.jcc(Jz);
+                    size_t fixnums = 0;
+                    if (prim[i] != PrimDiv) {
+                        a.bytes({0x83, 0xf8, Fixnums});      // cmp eax, Fixnums
+                        fixnums = a.jcc(Je);
+                    }
+                    a.load_double(0, x_off);
+                    a.load_double(1, y_off);
+                    switch (prim[i]) {
+                    case PrimAdd: a.bytes({0xf2, 0x0f, 0x58, 0xc1}); break; // addsd xmm0, xmm1
+                    case PrimSub: a.bytes({0xf2, 0x0f, 0x5c, 0xc1}); break; // subsd xmm0, xmm1
+                    case PrimMul: a.bytes({0xf2, 0x0f, 0x59, 0xc1}); break; // mulsd xmm0, xmm1
+                    case PrimDiv: a.bytes({0xf2, 0x0f, 0x5e, 0xc1}); break; // divsd xmm0, xmm1
+                    case PrimLt: a.bytes({0x66, 0x0f, 0x2e, 0xc8}); break;  // ucomisd xmm1, xmm0
+                    case PrimGt: a.bytes({0x66, 0x0f, 0x2e, 0xc1}); break;  // ucomisd xmm0, xmm1
+                    default: break;
+                    }
+                    if (fused) {
+                        // taken when unordered too, like the builtins
+                        jumps.push_back(make_pair(a.jcc(Jbe), arg_of(code[i+1])));
+                    }
+                    else if (compare) {
+                        a.bytes({0x0f, 0x97, 0xc0});         // seta al
+                        a.bytes({0x0f, 0xb6, 0xf0});         // movzx esi, al
+                        a.ctx_arg(); a.call(jit_push_bool); check();
+                    }
+                    else {
+                        a.ctx_arg(); a.call(jit_push_double); check();
+                    }
+                    vector<size_t> done(1, a.jmp());
+                    if (prim[i] != PrimDiv) {
+                        a.patch(fixnums, a.here());
+                        a.load_qword(0, i_off);
+                        a.load_qword(1, j_off);
+                        switch (prim[i]) {
+                        case PrimAdd: a.bytes({0x48, 0x01, 0xc8}); break;       // add rax, rcx
+                        case PrimSub: a.bytes({0x48, 0x29, 0xc8}); break;       // sub rax, rcx
+                        case PrimMul: a.bytes({0x48, 0x0f, 0xaf, 0xc1}); break; // imul rax, rcx
+                        default: a.bytes({0x48, 0x39, 0xc8}); break;            // cmp rax, rcx
+                        }
+                        if (fused) {
+                            const uint8_t cc = prim[i] == PrimLt ? Jge : Jle;
+                            jumps.push_back(make_pair(a.jcc(cc), arg_of(code[i+1])));
+                        }
+                        else if (compare) {
+                            if (prim[i] == PrimLt)
+                                a.bytes({0x0f, 0x9c, 0xc0});     // setl al
+                            else
+                                a.bytes({0x0f, 0x9f, 0xc0});     // setg al
+                            a.bytes({0x0f, 0xb6, 0xf0});         // movzx esi, al
+                            a.ctx_arg(); a.call(jit_push_bool); check();
+                        }
+                        else {
+                            size_t overflow = a.jcc(Jo);
+                            a.bytes({0x48, 0x89, 0xc6});         // mov rsi, rax
+                            a.ctx_arg(); a.call(jit_push_fixnum); check();
+                            done.push_back(a.jmp());
+                            a.patch(overflow, a.here());
+                            a.ctx_arg(); a.arg2(prim[i]);
+                            a.call(jit_push_overflow); check();
+                        }
+                        done.push_back(a.jmp());
+                    }
+                    a.patch(slow, a.here());
+                    a.ctx_arg(); a.arg2((uintptr_t)name); a.arg3(2);
+                    a.call(jit_call_global); check();
+                    if (fused) {
+                        a.ctx_arg(); a.call(jit_truth);
+                        a.test_eax();
+                        jumps.push_back(make_pair(a.jcc(Jz), arg_of(code[i+1])));
+                        offset[++i] = a.here();
+                    }
+                    for (size_t at : done)
+                        a.patch(at, a.here());
+                    if (op_of(w) == OpTailCall)
+                        a.ret(Done);
+                }
+                else if (op_of(w) == OpCall) {
+                    a.ctx_arg(); a.arg2(arg_of(w));
+                    a.call(jit_call); check();
+                }
+                else {
+                    // mov qword [rbx+_nargs], n
+                    a.bytes({0x48, 0xc7, 0x83}); a.dword(nargs_off); a.dword(arg_of(w));
+                    a.ret(TailCall);
+                }
+                break;
+            case OpReturn:
+                a.ret(Done);
+                break;
+            }
+        }
+        const size_t error_exit = a.here();
+        a.ret(Failed);
+
+        for (auto& j : jumps)
+            a.patch(j.first, offset[j.second]);
+        for (size_t at : failed)
+            a.patch(at, error_exit);
+
+        const size_t page = 4096;
+        const size_t size = (a._buf.size() + page - 1) & ~(page - 1);
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return;
+        memcpy(mem, &a._buf[0], a._buf.size());
+        if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(mem, size);
+            return;
+        }
+        bc._native = (native_fn)mem;
+        bc._native_size = size;
+    }
+
+#else
+
+    void jit_compile(bytecode& bc) {
+    }
+
+#endif
+}
+
+bool jit_hot(bytecode& code) {
+    if (code._native)
+        return true;
+    const unsigned threshold = interpreter::current->_jit_threshold;
+    if (threshold == 0 || ++code._calls != threshold)
+        return false;
+    jit_compile(code);
+    return code._native != nullptr;
+}
+
+sexpr jit_apply(const procedure_ptr& proc, sexprs& args) {
+    if (invoke(&ctx, proc, args) == Failed) {
+        exception_ptr e = ctx._error;
+        ctx._error = exception_ptr();
+        rethrow_exception(e);
+    }
+    sexpr result = std::move(ctx._stack.back());
+    ctx._stack.pop_back();
+    return result;
+}
+
+void jit_release(bytecode& code) {
+#if defined(__x86_64__)
+    if (code._native)
+        munmap((void*)code._native, code._native_size);
+#endif
+    code._native = nullptr;
+}
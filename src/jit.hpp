@@ -0,0 +1,17 @@
+#pragma once
+
+// a template jit for the vm: once a procedure body has been called
+// interpreter::_jit_threshold times its bytecode is translated to x86-64 machine
+// code, with calls into small helpers for everything but control
+// flow and fixnum or double arithmetic on the + - * / < > builtins
+
+#include "vm.hpp"
+
+// count a call to code and compile it once it is hot,
+// true if code can be run with jit_apply()
+bool jit_hot(bytecode& code);
+
+sexpr jit_apply(const procedure_ptr& proc, sexprs& args);
+
+// free the machine code of code, if any
+void jit_release(bytecode& code);
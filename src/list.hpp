@@ -0,0 +1,158 @@
+#pragma once
+
+#include "intrusive_ptr.hpp"
+#include "stats.hpp"
+#include <iterator>
+#include <vector>
+#include <cstddef>
+#include <type_traits>
+
+// immutable singly linked list with shared tails: copying a list,
+// taking its cdr and consing onto it are all O(1)
+//
+// nodes are reference counted, or with SCHEME_CELLGC defined they
+// come from the traced heap in gc.cpp and are only ever freed by
+// its collector
+
+namespace util {
+#ifdef SCHEME_CELLGC
+    void* node_alloc(size_t size);
+    void node_free(void* p);
+
+    // a plain pointer with the interface of intrusive_ptr
+    template <typename T>
+    struct traced_ptr {
+        traced_ptr() : _ptr(0) {
+        }
+        explicit traced_ptr(T* ptr) : _ptr(ptr) {
+        }
+        T* operator->() const { return _ptr; }
+        T* get() const { return _ptr; }
+        explicit operator bool() const { return _ptr != 0; }
+        bool operator!() const { return _ptr == 0; }
+        T* _ptr;
+    };
+#endif
+
+    template <typename T>
+    struct list {
+        struct node;
+
+        struct const_iterator : public std::iterator<std::forward_iterator_tag, const T> {
+            explicit const_iterator(const node* n = 0) : _n(n) {
+            }
+            const T& operator*() const { return _n->_car; }
+            const T* operator->() const { return &_n->_car; }
+            const_iterator& operator++() {
+                _n = _n->_cdr._head.get();
+                return *this;
+            }
+            const_iterator operator++(int) {
+                const_iterator tmp(*this);
+                ++*this;
+                return tmp;
+            }
+            bool operator==(const const_iterator& o) const { return _n == o._n; }
+            bool operator!=(const const_iterator& o) const { return _n != o._n; }
+            const node* _n;
+        };
+
+        typedef T value_type;
+        typedef const_iterator iterator;
+
+        list() : _head() {
+        }
+
+        list(const T& car, const list& cdr) : _head(new node(car, cdr)) {
+        }
+
+        // a list of the elements in [begin, end), which must be
+        // bidirectional since the list is built back to front
+        template <typename It, typename = typename std::enable_if<
+                                   std::is_pointer<It>::value ||
+                                   !std::is_convertible<It, T>::value>::type>
+        list(It begin, It end) : _head() {
+            while (end != begin)
+                *this = list(*--end, *this);
+        }
+
+        explicit list(const std::vector<T>& v) : _head() {
+            for (auto i = v.rbegin(); i != v.rend(); ++i)
+                *this = list(*i, *this);
+        }
+
+        bool empty() const { return !_head; }
+        size_t size() const { return _head ? _head->_size : 0; }
+
+        const T& front() const { return _head->_car; }
+
+        const T& back() const {
+            const node* n = _head.get();
+            while (n->_cdr._head)
+                n = n->_cdr._head.get();
+            return n->_car;
+        }
+
+        // the list without its first element, shares structure
+        const list& cdr() const {
+            return _head ? _head->_cdr : *this;
+        }
+
+        // O(i), meant for the fixed positions of special forms
+        const T& operator[](size_t i) const {
+            const node* n = _head.get();
+            for (; i > 0; --i)
+                n = n->_cdr._head.get();
+            return n->_car;
+        }
+
+        const_iterator begin() const { return const_iterator(_head.get()); }
+        const_iterator end() const { return const_iterator(); }
+
+#ifdef SCHEME_CELLGC
+        traced_ptr<const node> _head;
+#else
+        intrusive_ptr<const node> _head;
+#endif
+    };
+
+    template <typename T>
+    struct list<T>::node {
+#ifdef SCHEME_CELLGC
+        node(const T& car, const list& cdr)
+            : _size(cdr.size() + 1), _car(car), _cdr(cdr) {
+            STAT(allocations);
+            STAT_ADD(allocated_bytes, sizeof(node));
+        }
+
+        static void* operator new(size_t size) { return node_alloc(size); }
+        static void operator delete(void* p) { node_free(p); }
+#else
+        node(const T& car, const list& cdr)
+            : _rc(0), _size(cdr.size() + 1), _car(car), _cdr(cdr) {
+            STAT(allocations);
+            STAT_ADD(allocated_bytes, sizeof(node));
+        }
+
+        friend void incref(const node* n) {
+            ++n->_rc;
+        }
+
+        // unlinks the tail before deleting so that dropping
+        // a long list doesn't recurse once per element
+        friend void decref(const node* n) {
+            while (n && --n->_rc == 0) {
+                const node* next = n->_cdr._head._ptr;
+                const_cast<node*>(n)->_cdr._head._ptr = 0;
+                delete n;
+                n = next;
+            }
+        }
+
+        mutable long _rc;
+#endif
+        size_t _size;
+        T _car;
+        list _cdr;
+    };
+}
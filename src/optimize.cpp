@@ -0,0 +1,313 @@
+#include "optimize.hpp"
+#include "interpreter.hpp"
+
+using namespace std;
+using namespace boost;
+
+namespace {
+    // bodies bigger than this aren't inlined
+    const size_t MaxInlineWeight = 16;
+
+    // the names bound by the fn forms around the code being optimized
+    struct bindings {
+        bindings(const sexprs& names, const bindings* parent)
+            : _names(names), _parent(parent) {
+        }
+        sexprs _names;
+        const bindings* _parent;
+    };
+
+    bool bound_locally(const symbol& s, const bindings* b) {
+        for (; b; b = b->_parent)
+            if (index_of(b->_names, s) >= 0)
+                return true;
+        return false;
+    }
+
+    const symbol* symbol_of(const sexpr& x) {
+        if (auto a = get<atom>(&x))
+            return get<symbol>(a);
+        return nullptr;
+    }
+
+    // the value of x if it is a constant
+    bool constant(const sexpr& x, sexpr& value) {
+        if (auto a = get<atom>(&x)) {
+            if (get<symbol>(a))
+                return false;
+            value = x;
+            return true;
+        }
+        auto xl = get<sexpr_list>(&x);
+        if (!xl)
+            return false;
+        if (xl->empty()) {
+            value = x;
+            return true;
+        }
+        if (form_of(*xl) == SymQuote) {
+            value = (*xl)[1];
+            return true;
+        }
+        return false;
+    }
+
+    // code that evaluates to value
+    sexpr literal(const sexpr& value) {
+        if (auto a = get<atom>(&value))
+            if (!get<symbol>(a))
+                return value;
+        sexprs v;
+        v.push_back(atom(symbol(SymQuote)));
+        v.push_back(value);
+        return sexpr_list(v);
+    }
+
+    // the builtin a call to x reaches, if it is a pure one
+    const builtin* pure_callee(const sexpr& x, const bindings* b) {
+        const symbol* s = symbol_of(x);
+        envptr globals = global_env();
+        if (!s || bound_locally(*s, b) || !globals->bound(*s))
+            return nullptr;
+        const sexpr& fn = globals->cell(*s)->_value;
+        return is_pure(fn) ? get<builtin>(&fn) : nullptr;
+    }
+
+    // true if evaluating x can't have side effects: all it does
+    // is read variables and call pure builtins
+    bool is_pure_exp(const sexpr& x, const bindings* b) {
+        auto xl = get<sexpr_list>(&x);
+        if (!xl)
+            return get<atom>(&x) != nullptr;
+        if (xl->empty())
+            return true;
+        auto i = xl->begin();
+        switch (form_of(*xl)) {
+        case SymQuote:
+            return true;
+        case SymIf:
+            ++i;
+            break;
+        case -1:
+            if (!pure_callee(*i++, b))
+                return false;
+            break;
+        default:
+            return false;
+        }
+        for (; i != xl->end(); ++i)
+            if (!is_pure_exp(*i, b))
+                return false;
+        return true;
+    }
+
+    size_t weight(const sexpr& x) {
+        auto xl = get<sexpr_list>(&x);
+        if (!xl)
+            return 1;
+        size_t w = 1;
+        for (auto& e : *xl)
+            w += weight(e);
+        return w;
+    }
+
+    // how many times the variable s is referenced in x
+    size_t uses(const sexpr& x, const symbol& s) {
+        if (const symbol* sym = symbol_of(x))
+            return *sym == s;
+        auto xl = get<sexpr_list>(&x);
+        if (!xl || xl->empty() || form_of(*xl) == SymQuote)
+            return 0;
+        size_t n = 0;
+        for (auto& e : *xl)
+            n += uses(e, s);
+        return n;
+    }
+
+    // true if a name x refers to other than vars is bound differently
+    // at a call site inside b, where it would be captured
+    bool captured(const sexpr& x, const sexprs& vars, const bindings* b) {
+        if (const symbol* sym = symbol_of(x))
+            return index_of(vars, *sym) < 0 && bound_locally(*sym, b);
+        auto xl = get<sexpr_list>(&x);
+        if (!xl || xl->empty() || form_of(*xl) == SymQuote)
+            return false;
+        for (auto& e : *xl)
+            if (captured(e, vars, b))
+                return true;
+        return false;
+    }
+
+    sexpr substitute(const sexpr& x, const sexprs& vars, const sexprs& args) {
+        if (const symbol* sym = symbol_of(x)) {
+            int i = index_of(vars, *sym);
+            return i >= 0 ? args[i] : x;
+        }
+        auto xl = get<sexpr_list>(&x);
+        if (!xl || xl->empty() || form_of(*xl) == SymQuote)
+            return x;
+        sexprs v;
+        for (auto& e : *xl)
+            v.push_back(substitute(e, vars, args));
+        return sexpr_list(v);
+    }
+
+    // remember name as inlinable if exp is a small fn with a pure body
+    void consider(const symbol& name, const sexpr& exp) {
+        auto xl = get<sexpr_list>(&exp);
+        if (!xl || xl->empty() || form_of(*xl) != SymFn || xl->size() != 3)
+            return;
+        const sexpr_list& vars = get<sexpr_list>((*xl)[1]);
+        const sexpr& body = (*xl)[2];
+        if (is_variadic(vars) || weight(body) > MaxInlineWeight || uses(body, name))
+            return;
+        inlinable f;
+        f._vars.assign(vars.begin(), vars.end());
+        f._body = body;
+        bindings inner(f._vars, nullptr);
+        if (!is_pure_exp(body, &inner))
+            return;
+        interpreter::current->_inlinables[name] = f;
+    }
+
+    // the body of f with the arguments of call in place of its
+    // variables, if that means the same as making the call. the
+    // body has no side effects, so the arguments are substituted
+    // as long as they don't either
+    bool inline_call(const inlinable& f, const sexprs& call, const bindings* b, sexpr& out) {
+        if (call.size() - 1 != f._vars.size() || captured(f._body, f._vars, b))
+            return false;
+        sexprs args(call.begin() + 1, call.end());
+        for (size_t i = 0; i < args.size(); ++i) {
+            sexpr value;
+            if (symbol_of(args[i]) || constant(args[i], value))
+                continue;
+            // don't compute an argument more than once
+            const symbol& var = get<symbol>(get<atom>(f._vars[i]));
+            if (!is_pure_exp(args[i], b) || uses(f._body, var) > 1)
+                return false;
+        }
+        out = substitute(f._body, f._vars, args);
+        return true;
+    }
+
+    sexpr opt(const sexpr& x, const bindings* b, bool toplevel);
+
+    sexpr opt_do(const sexpr_list& v, const bindings* b, bool toplevel) {
+        sexprs body;
+        for (auto& e : v.cdr()) {
+            sexpr o = opt(e, b, toplevel);
+            auto ol = get<sexpr_list>(&o);
+            if (ol && !ol->empty() && form_of(*ol) == SymDo)
+                body.insert(body.end(), ol->cdr().begin(), ol->end());
+            else
+                body.push_back(o);
+        }
+        // constants before the last expression do nothing
+        sexprs kept;
+        for (size_t i = 0; i < body.size(); ++i) {
+            sexpr value;
+            if (i + 1 == body.size() || !constant(body[i], value))
+                kept.push_back(body[i]);
+        }
+        if (kept.empty())
+            return sexpr_list();
+        if (kept.size() == 1)
+            return kept[0];
+        kept.insert(kept.begin(), v[0]);
+        return sexpr_list(kept);
+    }
+
+    sexpr opt_call(const sexpr_list& v, const bindings* b) {
+        sexprs call;
+        for (auto& e : v)
+            call.push_back(opt(e, b, false));
+
+        if (const builtin* fn = pure_callee(call[0], b)) {
+            sexprs args;
+            for (size_t i = 1; i < call.size(); ++i) {
+                sexpr value;
+                if (!constant(call[i], value))
+                    break;
+                args.push_back(value);
+            }
+            // calls that fail are left for run time to report
+            if (args.size() == call.size() - 1) {
+                try {
+                    return literal((*fn)(sexpr_span(args)));
+                }
+                catch (std::exception&) {
+                }
+            }
+        }
+
+        if (const symbol* s = symbol_of(call[0])) {
+            const inlinable_map& inlinables = interpreter::current->_inlinables;
+            auto f = inlinables.find(*s);
+            sexpr body;
+            if (f != inlinables.end() && !bound_locally(*s, b) && inline_call(f->second, call, b, body))
+                return opt(body, b, false);
+        }
+        return sexpr_list(call);
+    }
+
+    sexpr opt(const sexpr& x, const bindings* b, bool toplevel) {
+        auto xl = get<sexpr_list>(&x);
+        if (!xl || xl->empty())
+            return x;
+        const sexpr_list& v = *xl;
+
+        const int form = form_of(v);
+        switch (form) {
+        case SymQuote:
+            return x;
+        case SymIf: {
+            sexpr test = opt(v[1], b, false);
+            sexpr value;
+            if (constant(test, value))
+                return opt(truth(value) ? v[2] : v[3], b, false);
+            sexprs ret;
+            ret.push_back(v[0]);
+            ret.push_back(test);
+            ret.push_back(opt(v[2], b, false));
+            ret.push_back(opt(v[3], b, false));
+            return sexpr_list(ret);
+        }
+        case SymSet:
+        case SymDefine: {
+            sexpr exp = opt(v[2], b, false);
+            const symbol* s = symbol_of(v[1]);
+            if (s && !bound_locally(*s, b)) {
+                interpreter::current->_inlinables.erase(*s);
+                if (form == SymDefine && toplevel)
+                    consider(*s, exp);
+            }
+            sexprs ret;
+            ret.push_back(v[0]);
+            ret.push_back(v[1]);
+            ret.push_back(exp);
+            return sexpr_list(ret);
+        }
+        case SymFn: {
+            const sexpr_list& vars = get<sexpr_list>(v[1]);
+            sexprs names(vars.begin(), vars.end());
+            if (is_variadic(vars))
+                names.pop_back();
+            collect_locals(v[2], names);
+            bindings inner(names, b);
+            sexprs ret;
+            ret.push_back(v[0]);
+            ret.push_back(v[1]);
+            ret.push_back(opt(v[2], &inner, false));
+            return sexpr_list(ret);
+        }
+        case SymDo:
+            return opt_do(v, b, toplevel);
+        }
+        return opt_call(v, b);
+    }
+}
+
+sexpr optimize(const sexpr& x) {
+    return opt(x, nullptr, true);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// an optional pass over expanded code, run before resolve() when
+// the interpreter is started with --optimize:
+//
+//  - calls to pure builtins with constant arguments are folded
+//  - an if with a constant test is replaced by the branch it takes
+//  - nested do forms are flattened, and constants dropped from them
+//  - calls to small non-recursive procedures bound at top level with
+//    def are replaced by their body
+//
+// it assumes that builtins and procedures inlined this way aren't
+// rebound once code using them has been read
+
+#include "scheme.hpp"
+#include <boost/unordered_map.hpp>
+
+// a top level procedure that calls can be replaced by its body,
+// kept by each interpreter
+struct inlinable {
+    sexprs _vars;
+    sexpr _body;
+};
+
+typedef boost::unordered_map<symbol, inlinable> inlinable_map;
+
+sexpr optimize(const sexpr& x);
@@ -0,0 +1,161 @@
+#include "printer.hpp"
+#include "table.hpp"
+#include "f64vector.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+using namespace boost;
+
+void format_double(double d, string& out) {
+    // the correctly rounded 15, 16 or 17 digits, whichever is the
+    // first to read back as d. 17 always does, and a number that
+    // can be written in fewer digits comes out of %.15g that way
+    char buf[32];
+    int n = 0;
+    for (int prec = 15; prec <= 17; ++prec) {
+        n = snprintf(buf, sizeof buf, "%.*g", prec, d);
+        if (prec == 17 || strtod(buf, nullptr) == d)
+            break;
+    }
+    out.append(buf, n);
+    if (!strpbrk(buf, ".eEin"))
+        out.append(".0");
+}
+
+printer::printer(string& buf) : _buf(buf), _out(nullptr) {
+}
+
+printer::printer(ostream& out) : _buf(_own), _out(&out) {
+    _own.reserve(SpillSize);
+}
+
+printer::~printer() {
+    flush();
+}
+
+void printer::flush() {
+    if (_out && !_buf.empty()) {
+        _out->write(_buf.data(), _buf.size());
+        _buf.clear();
+    }
+}
+
+printer& printer::display(const sexpr& x) {
+    const atom* a = get<atom>(&x);
+    const string* s = a ? get<string>(a) : nullptr;
+    if (!s)
+        return write(x);
+    put(*s);
+    spill();
+    return *this;
+}
+
+printer& printer::write(const sexpr& x) {
+    if (auto a = get<atom>(&x)) {
+        write_atom(*a);
+    }
+    else if (auto l = get<sexpr_list>(&x)) {
+        put('(');
+        for (auto i = l->begin(); i != l->end(); ++i) {
+            if (i != l->begin())
+                put(' ');
+            write(*i);
+        }
+        put(')');
+    }
+    else if (auto t = get<table_ptr>(&x)) {
+        const char* sep = "";
+        put('{');
+        (*t)->each([&](const atom& k, const sexpr& v) {
+            put(sep, strlen(sep));
+            write_atom(k);
+            put(' ');
+            write(v);
+            sep = " ";
+        });
+        put('}');
+    }
+    else if (auto v = get<vector_ptr>(&x)) {
+        put('[');
+        const sexprs& items = (*v)->_items;
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (i > 0)
+                put(' ');
+            write(items[i]);
+        }
+        put(']');
+    }
+    else if (auto v = get<f64vector_ptr>(&x)) {
+        // as the call that makes it
+        put("(f64vector", 10);
+        for (double d : (*v)->_data) {
+            put(' ');
+            write_double(d);
+            spill();
+        }
+        put(')');
+    }
+    else if (get<builtin>(&x)) {
+        put("<builtin>", 9);
+    }
+    else if (get<procedure_ptr>(&x)) {
+        put("<fn>", 4);
+    }
+    else if (auto r = get<localref>(&x)) {
+        put(r->_name.str());
+    }
+    else if (auto r = get<globalref>(&x)) {
+        put(r->_name.str());
+    }
+    spill();
+    return *this;
+}
+
+void printer::write_atom(const atom& a) {
+    if (auto i = get<fixnum>(&a))
+        write_fixnum(*i);
+    else if (auto d = get<double>(&a))
+        write_double(*d);
+    else if (auto s = get<symbol>(&a))
+        put(s->str());
+    else
+        write_string(get<string>(a));
+}
+
+void printer::write_string(const string& s) {
+    put('"');
+    for (char ch : s) {
+        if (isgraph((unsigned char)ch) || ch == ' ') {
+            if (ch == '\\' || ch == '"')
+                put('\\');
+            put(ch);
+            continue;
+        }
+        switch (ch) {
+        case '\n': put("\\n", 2); break;
+        case '\r': put("\\r", 2); break;
+        case '\t': put("\\t", 2); break;
+        default: put("\\?", 2); break;
+        }
+    }
+    put('"');
+}
+
+void printer::write_double(double d) {
+    format_double(d, _buf);
+}
+
+void printer::write_fixnum(fixnum i) {
+    char buf[24];
+    char* p = buf + sizeof buf;
+    uint64_t n = i < 0 ? 0 - (uint64_t)i : (uint64_t)i;
+    do {
+        *--p = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    if (i < 0)
+        *--p = '-';
+    put(p, buf + sizeof buf - p);
+}
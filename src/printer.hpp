@@ -0,0 +1,47 @@
+#pragma once
+
+// prints sexprs by appending to one growable buffer, rather than
+// building a string for every list and joining them. a printer on a
+// stream hands the buffer over in large pieces and leaves flushing
+// the stream to whoever needs the output to show
+
+#include "scheme.hpp"
+#include <ostream>
+
+class printer {
+public:
+    // appends to buf
+    explicit printer(std::string& buf);
+    // writes to out, when the buffer fills up and on flush()
+    explicit printer(std::ostream& out);
+    ~printer();
+
+    // as read back by the reader, strings quoted and escaped
+    printer& write(const sexpr& x);
+    // as pr shows it, a string as its characters
+    printer& display(const sexpr& x);
+
+    printer& put(char ch) { _buf.push_back(ch); return *this; }
+    printer& put(const char* s, size_t n) { _buf.append(s, n); return *this; }
+    printer& put(const std::string& s) { return put(s.data(), s.size()); }
+
+    // passes what is buffered on to the stream, without flushing it
+    void flush();
+
+private:
+    void write_atom(const atom& a);
+    void write_string(const std::string& s);
+    void write_double(double d);
+    void write_fixnum(fixnum i);
+    void spill() { if (_out && _buf.size() >= SpillSize) flush(); }
+
+    static const size_t SpillSize = 1 << 16;
+
+    std::string _own;
+    std::string& _buf;
+    std::ostream* _out;
+};
+
+// the shortest text that reads back as d, with .0 on whole numbers
+// so they don't read back as fixnums
+void format_double(double d, std::string& out);
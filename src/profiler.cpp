@@ -0,0 +1,133 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdio.h>
+#include <sys/time.h>
+
+using namespace std;
+
+volatile sig_atomic_t profile_due = 0;
+
+thread_local profiled_run* profiled_run::innermost = nullptr;
+
+namespace {
+    const long IntervalUsec = 1000;
+
+    // the names on the stack, from the outermost procedure in
+    typedef vector<symbol> stack;
+
+    mutex samples_lock;
+    map<stack, size_t> samples;
+
+    struct sigaction previous;
+
+    void on_timer(int) {
+        profile_due = 1;
+    }
+
+    void set_timer(long usec) {
+        itimerval t;
+        t.it_interval.tv_sec = 0;
+        t.it_interval.tv_usec = usec;
+        t.it_value = t.it_interval;
+        setitimer(ITIMER_PROF, &t, nullptr);
+    }
+}
+
+void profile_sample() {
+    profile_due = 0;
+
+    vector<const profiled_run*> runs;
+    for (const profiled_run* r = profiled_run::innermost; r; r = r->_outer)
+        runs.push_back(r);
+    vector<const environment*> frames;
+    for (auto i = runs.rbegin(); i != runs.rend(); ++i)
+        (*i)->_walk((*i)->_state, frames);
+
+    // a frame is on the stack once for every continuation in it, and
+    // the global environment isn't a procedure's
+    stack s;
+    const environment* last = nullptr;
+    for (const environment* e : frames) {
+        if (e && e != last && e->_parent)
+            s.push_back(e->_owner);
+        last = e;
+    }
+    lock_guard<mutex> hold(samples_lock);
+    ++samples[s];
+}
+
+void profile_start() {
+    {
+        lock_guard<mutex> hold(samples_lock);
+        samples.clear();
+    }
+    struct sigaction sa;
+    sa.sa_handler = on_timer;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &sa, &previous);
+    set_timer(IntervalUsec);
+}
+
+void profile_stop() {
+    set_timer(0);
+    sigaction(SIGPROF, &previous, nullptr);
+    profile_due = 0;
+}
+
+void profile_write_folded(ostream& out) {
+    lock_guard<mutex> hold(samples_lock);
+    for (auto& sample : samples) {
+        const stack& s = sample.first;
+        if (s.empty())
+            out << "toplevel";
+        for (size_t i = 0; i < s.size(); ++i)
+            out << (i ? ";" : "") << s[i].str();
+        out << " " << sample.second << "\n";
+    }
+}
+
+void profile_write_table(ostream& out) {
+    struct counts {
+        counts() : _self(0), _total(0) {}
+        size_t _self;
+        size_t _total;
+    };
+    map<symbol, counts> by_name;
+    size_t total = 0;
+    {
+        lock_guard<mutex> hold(samples_lock);
+        for (auto& sample : samples) {
+            const stack& s = sample.first;
+            const size_t n = sample.second;
+            total += n;
+            if (s.empty())
+                continue;
+            by_name[s.back()]._self += n;
+            // once per sample however deep it recurses
+            stack seen(s);
+            sort(seen.begin(), seen.end());
+            seen.erase(unique(seen.begin(), seen.end()), seen.end());
+            for (const symbol& name : seen)
+                by_name[name]._total += n;
+        }
+    }
+    vector<pair<symbol, counts> > rows(by_name.begin(), by_name.end());
+    sort(rows.begin(), rows.end(), [](const pair<symbol, counts>& a, const pair<symbol, counts>& b) {
+        if (a.second._self != b.second._self)
+            return a.second._self > b.second._self;
+        return a.second._total > b.second._total;
+    });
+
+    out << total << " samples, " << IntervalUsec / 1000.0 << "ms apart\n";
+    out << "  self%  total%  name\n";
+    for (auto& row : rows) {
+        char line[32];
+        snprintf(line, sizeof line, "%7.1f %7.1f  ",
+                 100.0 * row.second._self / total, 100.0 * row.second._total / total);
+        out << line << row.first.str() << "\n";
+    }
+}
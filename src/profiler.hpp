@@ -0,0 +1,52 @@
+#pragma once
+
+// a sampling profiler. while it runs, a SIGPROF timer marks a sample
+// as due and the engines take it at their next procedure call, by
+// walking the call frames they hold. a sample is the names of the
+// procedures with frames on the stack from the outermost in, as
+// bound by def or :, or fn for anonymous ones. a tail call takes the
+// place of its caller, so it shows up in place of it too. time spent
+// in a builtin goes to the next call made, so one that runs long
+// without calling back is charged to whatever is called after it
+
+#include "scheme.hpp"
+#include <signal.h>
+#include <iosfwd>
+
+// set by the timer when a sample is due
+extern volatile sig_atomic_t profile_due;
+
+// a loop of eval, the vm or the jit on this thread, registered for
+// as long as it runs. walk appends the frames of the loop to frames,
+// the outermost first
+struct profiled_run {
+    typedef void (*walker)(const void* state, std::vector<const environment*>& frames);
+
+    profiled_run(walker walk, const void* state)
+        : _walk(walk), _state(state), _outer(innermost) {
+        innermost = this;
+    }
+    ~profiled_run() {
+        innermost = _outer;
+    }
+
+    walker _walk;
+    const void* _state;
+    profiled_run* _outer;
+
+    static thread_local profiled_run* innermost;
+};
+
+// records the stack of this thread and clears profile_due
+void profile_sample();
+
+// forgets the samples so far and starts the timer
+void profile_start();
+void profile_stop();
+
+// one "outer;...;inner count" line per stack, as flamegraph.pl reads
+void profile_write_folded(std::ostream& out);
+
+// how much of the time each procedure was running itself, and was
+// on the stack at all
+void profile_write_table(std::ostream& out);
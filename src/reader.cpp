@@ -0,0 +1,95 @@
+#include "reader.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace {
+    // text that isn't worth a thread of its own
+    const size_t MinPiece = 1 << 18;
+
+    // more pieces than threads, so that one slow piece doesn't hold
+    // up the rest
+    const size_t PiecesPerThread = 4;
+
+    // an error ends the form it's in, reading goes on after it as
+    // the repl does
+    template <typename Fn>
+    void read_piece(const char* begin, const char* end, Fn each) {
+        token_stream tokens(begin, end);
+        while (true) {
+            read_result r;
+            try {
+                const token_stream::Token token = tokens.next();
+                if (token == token_stream::Eof)
+                    break;
+                r._form = read_ahead(tokens, token);
+            }
+            catch (...) {
+                r._error = current_exception();
+            }
+            each(r);
+        }
+    }
+}
+
+void read_forms(const char* begin, const char* end,
+                const function<void(const read_result&)>& each) {
+    size_t threads = max(thread::hardware_concurrency(), 1u);
+    threads = min(threads, (size_t)(end - begin) / MinPiece);
+#ifdef SCHEME_CELLGC
+    threads = 1;
+#endif
+    if (threads <= 1) {
+        read_piece(begin, end, each);
+        return;
+    }
+
+    const vector<const char*> points = split_forms(begin, end, threads * PiecesPerThread);
+    const size_t n = points.size() - 1;
+    vector<vector<read_result> > pieces(n);
+    vector<bool> done(n, false);
+    mutex lock;
+    condition_variable ready;
+    atomic<size_t> next(0);
+
+    auto work = [&] {
+        for (size_t i; (i = next++) < n; ) {
+            vector<read_result> forms;
+            read_piece(points[i], points[i + 1], [&](read_result& r) {
+                forms.push_back(std::move(r));
+            });
+            lock_guard<mutex> hold(lock);
+            pieces[i].swap(forms);
+            done[i] = true;
+            ready.notify_all();
+        }
+    };
+    vector<thread> pool;
+    for (size_t i = 0; i < threads; ++i)
+        pool.emplace_back(work);
+
+    try {
+        for (size_t i = 0; i < n; ++i) {
+            vector<read_result> forms;
+            {
+                unique_lock<mutex> hold(lock);
+                ready.wait(hold, [&] { return done[i]; });
+                forms.swap(pieces[i]);
+            }
+            for (auto& r : forms)
+                each(r);
+        }
+    }
+    catch (...) {
+        next = n;
+        for (auto& t : pool)
+            t.join();
+        throw;
+    }
+    for (auto& t : pool)
+        t.join();
+}
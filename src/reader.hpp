@@ -0,0 +1,29 @@
+#pragma once
+
+// reading a whole text of top level forms. a large text is cut
+// between forms with split_forms() and the pieces are read on a pool
+// of threads, which the reader can do since reading only ever looks
+// at the symbol table. the forms are handed over in order as their
+// pieces are done, so they can be run while the rest are read
+//
+// with SCHEME_CELLGC the lists would be allocated from the traced
+// heap, which isn't thread safe, so everything is read on the
+// calling thread
+
+#include "scheme.hpp"
+#include "tokens.hpp"
+#include <exception>
+#include <functional>
+
+// in scheme.cpp
+sexpr read_ahead(token_stream& s, token_stream::Token token);
+
+// a form, or what went wrong reading it
+struct read_result {
+    sexpr _form;
+    std::exception_ptr _error;
+};
+
+// calls each with every form in [begin, end) on the calling thread
+void read_forms(const char* begin, const char* end,
+                const std::function<void(const read_result&)>& each);
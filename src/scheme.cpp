@@ -8,51 +8,47 @@
 #include <boost/variant.hpp>
 #include <boost/variant/apply_visitor.hpp>
 #include <boost/variant/static_visitor.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/type_traits.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/exception/diagnostic_information.hpp>
-#include <boost/bind.hpp>
 #include <vector>
 #include <string>
 #include <sstream>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <stdlib.h>
+#include <limits>
+#include <atomic>
 #include <math.h>
-#include "join.hpp"
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "tokens.hpp"
+#include "scheme.hpp"
+#include "vm.hpp"
+#include "jit.hpp"
+#include "gc.hpp"
+#include "optimize.hpp"
+#include "serial.hpp"
+#include "table.hpp"
+#include "f64vector.hpp"
+#include "printer.hpp"
+#include "reader.hpp"
+#include "profiler.hpp"
+#include "interpreter.hpp"
 
 using namespace std;
 using namespace boost;
 
-struct symbol : public string {
-    symbol() : string() {}
-    symbol(const char* a, const char* b) : string(a, b) {}
-    explicit symbol(const char* s) : string(s) {}
-    explicit symbol(string&& o) : string(o) {}
-};
-
-class procedure;
-
-typedef variant<double, string, symbol> atom;
-typedef shared_ptr<procedure> procedure_ptr;
-typedef make_recursive_variant<atom,
-                               vector<recursive_variant_>,
-                               procedure_ptr,
-                               function1<recursive_variant_, const void*>>::type sexpr;
-typedef vector<sexpr> sexprs;
-typedef function1<sexpr, const void*> builtin;
-
-void vec_arg(sexprs& v, int a) { v.push_back(atom((double)a)); }
+void vec_arg(sexprs& v, int a) { v.push_back(atom((fixnum)a)); }
 void vec_arg(sexprs& v, double a) { v.push_back(atom(a)); }
 void vec_arg(sexprs& v, const symbol& a) { v.push_back(atom(a)); }
 void vec_arg(sexprs& v, const std::string& a) { v.push_back(atom(a)); }
 void vec_arg(sexprs& v, const sexpr& l) { v.push_back(l); }
-void vec_arg(sexprs& v, const sexprs& l) { v.push_back(l); }
+void vec_arg(sexprs& v, const sexpr_list& l) { v.push_back(l); }
 
 template <class T, typename... Ts>
 void vec_arg(sexprs& v, const T& t, const Ts&... ts) {
@@ -61,57 +57,20 @@ void vec_arg(sexprs& v, const T& t, const Ts&... ts) {
 }
 
 template <typename... Ts>
-sexprs make_list(const Ts&... ts) {
+sexpr_list make_list(const Ts&... ts) {
     sexprs v;
     v.reserve(sizeof...(ts));
     vec_arg(v, ts...);
-    return v;
+    return sexpr_list(v);
 }
 
-string escape_string(const string& s) {
-    stringstream ss;
-    ss << '"';
-    for (auto i = s.begin(); i != s.end(); ++i) {
-        if (isgraph(*i) || *i == ' ')
-            ss << *i;
-        else {
-            switch (*i) {
-            case '\\': ss << "\\\\"; break;
-            case '\n': ss << "\\n"; break;
-            case '\t': ss << "\\t"; break;
-            case '"': ss << "\\\""; break;
-            default: ss << "\\?"; break;
-            }
-        }
-    }
-    ss << '"';
-    return ss.str();
+string to_str(const sexpr& l) {
+    string s;
+    printer(s).write(l);
+    return s;
 }
 
-struct atom2s : public static_visitor<string> {
-    string operator()(const string& x) const { return escape_string(x); }
-    string operator()(const symbol& x) const { return x; }
-    string operator()(double x) const { return lexical_cast<string>(x); }
-};
-
-struct sexpr2s : public static_visitor<string> {
-    string operator()(const atom& a) const { return apply_visitor(atom2s(), a); }
-    string operator()(const builtin& fn) const { return "<builtin>"; }
-    string operator()(const procedure_ptr& fn) const { return "<fn>"; }
-    string operator()(const sexprs& v) const {
-        stringstream ss;
-        ss << "("
-           << util::mapjoin(" ", v.begin(), v.end(), [](const sexpr& x) {
-                return apply_visitor(sexpr2s(), x);
-            })
-           << ")";
-        return ss.str();
-    }
-};
-
-string to_str(const sexpr& l) { return apply_visitor(sexpr2s(), l); }
-
-string to_str(const atom& a) { return apply_visitor(atom2s(), a); }
+string to_str(const atom& a) { return to_str(sexpr(a)); }
 
 struct syntax_error : public runtime_error {
     explicit syntax_error(const sexpr& sx)
@@ -129,644 +88,1524 @@ struct syntax_error : public runtime_error {
     do{if(!(cond)){throw syntax_error(sx, msg);}}while(false)
 
 sexpr read(token_stream& s);
+sexpr read_ahead(token_stream& s, token_stream::Token token);
+
+namespace {
+    // the powers of ten a double holds exactly
+    const double exact_powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    bool is_digit(char ch) { return ch >= '0' && ch <= '9'; }
+
+    // digits as a double, by strtod so it's rounded correctly. they
+    // go in with an exponent and no decimal point, which is the part
+    // of the syntax that depends on the locale
+    double digits_to_double(const char* begin, const char* end, long exp10) {
+        char local[64];
+        string big;
+        const size_t n = (end - begin) + 24;
+        char* buf = local;
+        if (n > sizeof local) {
+            big.resize(n);
+            buf = &big[0];
+        }
+        char* out = buf;
+        for (const char* p = begin; p != end; ++p)
+            if (is_digit(*p))
+                *out++ = *p;
+        snprintf(out, 24, "e%ld", exp10);
+        return strtod(buf, nullptr);
+    }
+}
+
+// integer literals become fixnums unless they overflow. other
+// numbers are worked out from the digits directly when they and the
+// power of ten fit a double exactly, which takes one correctly rounded
+// multiply or divide, and by strtod when they don't
+atom read_number(string_ref text) {
+    const char* p = text.begin();
+    const char* const end = text.end();
+    const bool negative = p != end && *p == '-';
+    if (negative)
+        ++p;
+
+    const char* const digits = p;
+    uint64_t mantissa = 0;
+    int significant = 0; // digits in mantissa, not counting leading zeros
+    bool exact = true;   // all of them made it into mantissa
+    long exp10 = 0;
+    bool integral = true;
+    int count = 0;
+    for (; p != end && is_digit(*p); ++p, ++count) {
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            significant += mantissa != 0;
+        }
+        else {
+            exact = exact && *p == '0';
+            ++exp10;
+        }
+    }
+    if (p != end && *p == '.') {
+        integral = false;
+        for (++p; p != end && is_digit(*p); ++p, ++count) {
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                significant += mantissa != 0;
+                --exp10;
+            }
+            else {
+                exact = exact && *p == '0';
+            }
+        }
+    }
+    const char* const digits_end = p;
+    long exponent = 0;
+    if (count > 0 && p != end && (*p == 'e' || *p == 'E')) {
+        integral = false;
+        ++p;
+        const bool negative_exponent = p != end && *p == '-';
+        if (p != end && (*p == '-' || *p == '+'))
+            ++p;
+        if (p == end || !is_digit(*p))
+            count = 0;
+        for (; p != end && is_digit(*p); ++p)
+            if (exponent < 100000)
+                exponent = exponent * 10 + (*p - '0');
+        if (negative_exponent)
+            exponent = -exponent;
+    }
+    if (count == 0 || p != end)
+        throw runtime_error("bad number: " + text.to_string());
+
+    if (integral && exact && exp10 == 0) {
+        const uint64_t limit = (uint64_t)numeric_limits<fixnum>::max() + negative;
+        if (mantissa <= limit)
+            return atom(negative ? (fixnum)(0 - mantissa) : (fixnum)mantissa);
+    }
+
+    double d;
+    exp10 += exponent;
+    if (exact && mantissa <= (1ull << 53) && exp10 >= -22 && exp10 <= 22) {
+        d = (double)mantissa;
+        d = exp10 < 0 ? d / exact_powers[-exp10] : d * exact_powers[exp10];
+    }
+    else {
+        // as many digits again as there are after the point
+        long point = 0;
+        for (const char* q = digits; q != digits_end && *q != '.'; ++q)
+            ++point;
+        const long after = count - point;
+        d = digits_to_double(digits, digits_end, exponent - after);
+    }
+    return atom(negative ? -d : d);
+}
+
+// the elements up to the close token, after what's in v already
+sexpr_list read_until(token_stream& s, token_stream::Token close, sexprs v = sexprs()) {
+    while (true) {
+        token_stream::Token token = s.next();
+        if (token == close)
+            return sexpr_list(v);
+        if (token == token_stream::Eof)
+            throw runtime_error("unexpected end of input");
+        v.push_back(read_ahead(s, token));
+    }
+}
 
 sexpr read_ahead(token_stream& s, token_stream::Token token) {
     switch (token) {
     case token_stream::Eof:
-        return sexprs();
-    case token_stream::LParen: {
-        sexprs v;
-        while (true) {
-            token = s.next();
-            if (token == token_stream::RParen)
-                return v;
-            v.push_back(read_ahead(s, token));
-        }
-    }
+        return sexpr_list();
+    case token_stream::LParen:
+        return read_until(s, token_stream::RParen);
+    // {k v ...} and [a b c] are calls to the constructors
+    case token_stream::LMap:
+        return read_until(s, token_stream::RMap, sexprs(1, atom(symbol("table"))));
+    case token_stream::LVec:
+        return read_until(s, token_stream::RVec, sexprs(1, atom(symbol("vector"))));
     case token_stream::RParen:
         throw runtime_error("unexpected )");
+    case token_stream::RMap:
+        throw runtime_error("unexpected }");
+    case token_stream::RVec:
+        throw runtime_error("unexpected ]");
     case token_stream::Quote:
     case token_stream::Quasiquote:
     case token_stream::Unquote:
     case token_stream::UnquoteSplicing: {
-        sexprs v;
-        v.push_back(atom(symbol(boost::move(s.text))));
-        v.push_back(read(s));
-        return v;
+        sexpr head = atom(symbol(s.text));
+        return make_list(head, read(s));
     }
     case token_stream::Symbol:
-        return atom(symbol(boost::move(s.text)));
+        return atom(symbol(s.text));
     case token_stream::Number:
-        return atom(lexical_cast<double>(s.text));
+        return read_number(s.text);
     default:
     case token_stream::String:
-        return atom(s.text);
+        return atom(s.text.to_string());
     }
 }
 
-struct environment {
-    environment()
-        : _parent(),
-          _env() {
-        _env["t"] = atom(symbol("t"));
-        _env["f"] = sexprs();
-        _env["nil"] = sexprs();
-    }
-
-    environment(const sexprs& vars, const sexprs& args, const shared_ptr<environment> parent)
-        : _parent(parent),
-          _env() {
-        _parent = parent;
-        if (vars.size() != args.size())
-            throw runtime_error("argument arity mismatch");
-        for (auto i = vars.begin(), k = args.begin(); i != vars.end(); ++i, ++k) {
-            _env[to_str(*i)] = *k;
-        }
-    }
 
-    environment& add(const char* id, const sexpr& x) {
-        _env[id] = x;
-        return *this;
-    }
+thread_local interpreter* interpreter::current = nullptr;
 
-    environment& find(const string& x) {
-        if (_env.find(x) != _env.end())
-            return *this;
-        else if (_parent)
-            return _parent->find(x);
-        else
-            throw runtime_error("unknown symbol: " + x);
-    }
-
-    environment& find(const sexpr& x) {
-        return find(to_str(x));
-    }
+envptr global_env() {
+    return interpreter::current->_globals;
+}
 
-    sexpr& operator[](const string& s) {
-        return _env[s];
-    }
+arg_stack& builtin_args() {
+    return interpreter::current->_args;
+}
 
-    sexpr& operator[](const sexpr& x) {
-        return _env[to_str(x)];
-    }
+#ifdef SCHEME_STATS
+thread_local eval_stats stats;
 
-    shared_ptr<environment> _parent;
-    unordered_map<string, sexpr> _env;
-};
+eval_stats current_stats() {
+    return stats;
+}
 
-typedef shared_ptr<environment> envptr;
+void reset_stats() {
+    stats = eval_stats();
+}
+#endif
 
 namespace {
+    // frames are laid out as the environment followed by its slots
+    const size_t SlotsOffset =
+        (sizeof(environment) + alignof(sexpr) - 1) & ~(alignof(sexpr) - 1);
 
-    bool is_call_to(const sexprs& v, const char* s) {
-        auto a = get<atom>(&v.front());
-        if (a) {
-            auto sym = get<symbol>(a);
-            if (sym) {
-                return *sym == s;
-            }
-        }
-        return false;
+    size_t frame_bytes(size_t nslots) {
+        return SlotsOffset + nslots * sizeof(sexpr);
+    }
+
+    void destroy_frame(environment* e) {
+        const size_t n = e->_names.size();
+        for (size_t i = 0; i < n; ++i)
+            e->_slots[i].~sexpr();
+        e->~environment();
     }
+}
 
-    bool truth(const sexpr& x) {
-        const sexprs* v = get<sexprs>(&x);
-        return !(v && v->size() == 0);
+void frame_stack::pop_dead() {
+    while (_last && _last->_rc == 0) {
+        environment* e = _last;
+        _last = e->_below;
+        _top = (char*)e;
+        destroy_frame(e);
     }
+}
 
-    envptr global_env;
+envptr make_frame(const procedure& proc, sexpr* args, size_t n) {
+    STAT(calls);
+    const size_t fixed = proc._variadic ? proc._nargs - 1 : proc._nargs;
+    if (proc._variadic ? n < fixed : n != fixed)
+        throw runtime_error(proc._variadic ? "bad arity" : "argument arity mismatch");
+    sexpr_list rest;
+    if (proc._variadic)
+        rest = sexpr_list(args + fixed, args + n);
+
+    const size_t nslots = proc._names.size();
+    frame_stack& frames = interpreter::current->_frames;
+    void* mem = proc._escapes ? 0 : frames.alloc(frame_bytes(nslots));
+    const bool stacked = mem != 0;
+    if (!stacked)
+        mem = ::operator new(frame_bytes(nslots));
+    sexpr* slots = (sexpr*)((char*)mem + SlotsOffset);
+    size_t i = 0;
+    for (; i < fixed; ++i)
+        new (&slots[i]) sexpr(std::move(args[i]));
+    if (proc._variadic)
+        new (&slots[i++]) sexpr(std::move(rest));
+    for (; i < nslots; ++i)
+        new (&slots[i]) sexpr(sexpr_list());
+
+    environment* e = new (mem) environment(proc._parent, proc._names, slots, stacked);
+    e->_owner = proc._name;
+    if (stacked)
+        frames.push(e);
+    return envptr(e);
+}
 
-    map<symbol, sexpr> macro_table;
+void free_frame(environment* e) {
+    if (e->_stacked) {
+        interpreter::current->_frames.pop_dead();
+        return;
+    }
+    destroy_frame(e);
+    ::operator delete(e);
 }
 
 sexpr read(token_stream& s);
 sexpr parse(token_stream& s);
-sexpr eval(sexpr x, envptr env = global_env);
+sexpr compile_toplevel(sexpr x);
 sexpr expand(sexpr x, bool toplevel = false);
 sexpr expand_quasiquote(const sexpr& x);
+struct scope;
+sexpr resolve(const sexpr& x, const scope* sc = nullptr);
 
 sexpr read(token_stream& s) {
     return read_ahead(s, s.next());
 }
 
-sexpr parse(token_stream& s) {
-    return expand(read(s), true);
+// the rest of the way from an expanded top level form to code
+sexpr compile_toplevel(sexpr x) {
+    if (interpreter::current->_optimizing)
+        x = optimize(x);
+    return resolve(x);
 }
 
-struct procedure {
-    procedure(const sexprs& vars, const sexpr& exp, const envptr& parent)
-        : _vars(vars), _exp(exp), _parent(parent), _variadic(false) {
-        if (vars.size() > 1) {
-            const symbol* sym;
-            if ((sym = get<symbol>(&get<atom>(vars.back()))) && (*sym == "...")) {
-                _variadic = true;
-                _vars.pop_back();
-            }
-        }
-    }
-    void variadic(sexprs& exps) const {
-        if (_variadic) {
-            const size_t nargs = _vars.size()-1;
-            if (exps.size() < nargs)
-                throw runtime_error("bad arity");
-            sexprs tail(exps.begin()+nargs, exps.end());
-            exps.erase(exps.begin()+nargs, exps.end());
-            exps.push_back(tail);
-        }
-    }
-    sexprs _vars;
-    sexpr _exp;
-    envptr _parent;
-    bool _variadic;
-};
-
-template <int, typename Fn>
-struct builtin_impl;
-
-template <typename Fn>
-struct builtin_impl<0, Fn> {
-    builtin_impl(const Fn& fn) : _fn(fn) {
-    }
-    sexpr operator()(const void* arghack) {
-        const sexprs& args = *(const sexprs*)(arghack);
-        if (args.size() != 0) throw runtime_error("bad arity");
-        return _fn();
-    }
-    function<Fn> _fn;
-};
-
-template <typename Fn>
-struct builtin_impl<1, Fn> {
-    builtin_impl(const Fn& fn) : _fn(fn) {
-    }
-    sexpr operator()(const void* arghack) {
-        const sexprs& args = *(const sexprs*)(arghack);
-        if (args.size() != 1) throw runtime_error("bad arity");
-        return _fn(args[0]);
-    }
-    function<Fn> _fn;
-};
-
-template <typename Fn>
-struct builtin_impl<2, Fn> {
-    builtin_impl(const Fn& fn) : _fn(fn) {
-    }
-    sexpr operator()(const void* arghack) {
-        const sexprs& args = *(const sexprs*)(arghack);
-        if (args.size() != 2) throw runtime_error("bad arity");
-        return _fn(args[0], args[1]);
-    }
-    function<Fn> _fn;
-};
-
-sexpr make_procedure(const sexprs& vars, const sexpr& exp, const envptr& env) {
-    return procedure_ptr(new procedure(vars, exp, env));
+sexpr parse(token_stream& s) {
+    return compile_toplevel(expand(read(s), true));
 }
 
-template <typename Fn>
-sexpr make_builtin(const Fn& fn) {
-    return builtin(builtin_impl<function_traits<Fn>::arity, Fn>(fn));
-}
 
-template <typename Fn>
-sexpr make_builtin_va(const Fn& fn) {
-    return builtin([=](const void* a) {
-            return fn(*(const sexprs*)a);
-        });
+sexpr make_procedure(const sexpr_list& vars, const sexpr& exp, const envptr& env,
+                     const sexpr_list& names, bool escapes, const symbol& name) {
+    return procedure_ptr(new procedure(vars, exp, env, names, escapes, name));
 }
 
-sexprs map_expand(sexprs lst, bool toplevel = false) {
-    for (sexpr& x : lst)
-        x = expand(x, toplevel);
-    return lst;
+template <typename Fn>
+sexpr make_builtin(Fn fn) {
+    return builtin(fn);
 }
 
-
-sexprs cdr(const sexprs& x) {
-    if (x.size() <= 1)
-        return sexprs();
-    return sexprs(++x.begin(), x.end());
+sexpr_list map_expand(const sexpr_list& lst, bool toplevel = false) {
+    sexprs v;
+    v.reserve(lst.size());
+    for (const sexpr& x : lst)
+        v.push_back(expand(x, toplevel));
+    return sexpr_list(v);
 }
 
 sexpr expand(sexpr x, bool toplevel) {
     // macro expansion, todo
 
-    if (get<sexprs>(&x) == nullptr)
+    if (get<sexpr_list>(&x) == nullptr)
         return x; // non-lists pass through
-    sexprs& xl = get<sexprs>(x);
-    if (xl.size() == 0)
+    const sexpr_list& xl = get<sexpr_list>(x);
+    if (xl.empty())
         return xl;
 
-    if (is_call_to(xl, "quote")) {
+    switch (form_of(xl)) {
+    case SymQuote:
         REQUIRE(x, xl.size() == 2);
         return x;
-    }
-    else if (is_call_to(xl, "if")) {
+    case SymIf:
+        REQUIRE(x, xl.size() == 3 || xl.size() == 4);
         if (xl.size() == 3)
-            xl.push_back(sexprs());
-        REQUIRE(x, xl.size() == 4);
+            return map_expand(make_list(xl[0], xl[1], xl[2], sexpr_list()));
         return map_expand(xl);
-    }
-    else if (is_call_to(xl, "=") || is_call_to(xl, ":")) {
+    case SymSet:
+    case SymDefine: {
         REQUIRE(x, xl.size() == 3);
         auto var = &xl[1];
         REQUIRE(x, get<symbol>(get<atom>(var)));
         return make_list(xl[0], xl[1], expand(xl[2]));
     }
-    else if (is_call_to(xl, "def")) {
+    case SymDef: {
         // valid forms: (def foo () body)
         // (def foo (x ...) body)
         REQUIRE(x, xl.size() >= 4);
-        auto& _def = xl[0];
         auto& f = xl[1];
         auto& v = xl[2];
-        sexprs fn = make_list(symbol("fn"), v);
-        fn.insert(fn.end(), xl.begin()+3, xl.end());
-        return expand(make_list(symbol(":"), f, fn));
+        sexpr_list fn(atom(symbol(SymFn)), sexpr_list(v, xl.cdr().cdr().cdr()));
+        return expand(make_list(symbol(SymDefine), f, fn));
     }
-    else if (is_call_to(xl, "defmacro")) {
+    case SymDefmacro: {
         // (defmacro foo proc)
         REQUIRE2(x, toplevel, "defmacro only allowed at top level");
         REQUIRE(x, xl.size() == 3);
         auto var = get<symbol>(get<atom>(xl[1]));
-        sexpr proc = eval(expand(xl[2]));
-        REQUIRE(x, get<procedure_ptr>(proc) || get<builtin>(proc));
+        sexpr proc = exec(resolve(expand(xl[2])));
+        REQUIRE(x, get<procedure_ptr>(&proc) || get<builtin>(&proc));
 
-        macro_table[var] = proc;
+        interpreter& in = *interpreter::current;
+        in._macros[var] = proc;
+        gc_addroot(&in._macros[var]);
+        ++in._macro_definitions;
 
-        return sexprs();
+        return sexpr_list();
     }
-    else if (is_call_to(xl, "do")) {
+    case SymDo:
         if (xl.size() == 1)
-            return sexprs();
+            return sexpr_list();
         return map_expand(xl, toplevel);
-    }
-    else if (is_call_to(xl, "fn")) {
+    case SymFn: {
         // (fn (x) e1 e2) => (fn (x) (do e1 e2))
         REQUIRE(x, xl.size() >= 3);
-        auto vars = get<sexprs>(&xl[1]);
+        auto vars = get<sexpr_list>(&xl[1]);
         REQUIRE(x, vars);
         for (auto& var : *vars)
             REQUIRE(x, get<symbol>(get<atom>(&var)));
         if (xl.size() == 3)
             return make_list(xl[0], *vars, expand(xl[2]));
 
-        sexprs body = make_list(symbol("do"));
-        body.insert(body.end(), xl.begin()+2, xl.end());
+        sexpr_list body(atom(symbol(SymDo)), xl.cdr().cdr());
         return make_list(xl[0], *vars, expand(body));
     }
-    else if (is_call_to(xl, "quasiquote")) {
+    case SymQuasiquote:
         REQUIRE(x, xl.size() == 2);
         return expand_quasiquote(xl[1]);
-    }
-    else if (symbol* s = get<symbol>(get<atom>(&xl[0]))) {
-        auto mac = macro_table.find(*s);
-        if (mac != macro_table.end()) {
+    default:
+        if (const symbol* s = get<symbol>(get<atom>(&xl[0]))) {
+            const map<symbol, sexpr>& macros = interpreter::current->_macros;
+            auto mac = macros.find(*s);
+            if (mac != macros.end()) {
 
-            sexprs exps(xl.begin()+1, xl.end());
+                sexprs exps(xl.cdr().begin(), xl.end());
+                STAT(expansions);
 
-            if (auto p = get<procedure_ptr>(&(mac->second))) {
-                const auto& proc = *(*p);
-                proc.variadic(exps);
-                envptr env(new environment(proc._vars, exps, proc._parent));
-                return expand(eval(proc._exp, env), toplevel);
-            }
-            else if (auto l = get<builtin>(&(mac->second))) {
-                return expand((*l)(&exps), toplevel);
-            }
-            else {
-                throw std::runtime_error("bad data in macro_table");
+                return expand(apply(mac->second, exps), toplevel);
             }
         }
-        else {
-            return map_expand(xl);
-        }
-    }
-    else {
         return map_expand(xl);
     }
 }
 
 bool is_pair(const sexpr& x) {
-    auto p = get<sexprs>(&x);
-    return p && p->size() > 0;
+    auto p = get<sexpr_list>(&x);
+    return p && !p->empty();
 }
 
 sexpr expand_quasiquote(const sexpr& x) {
     if (!is_pair(x))
-        return make_list(symbol("quote"), x);
-    auto& xl = get<sexprs>(x);
+        return make_list(symbol(SymQuote), x);
+    auto& xl = get<sexpr_list>(x);
 
-    REQUIRE2(x, !is_call_to(xl, "unquote-splicing"), "can't splice here");
+    REQUIRE2(x, !is_call_to(xl, SymUnquoteSplicing), "can't splice here");
 
-    if (is_call_to(xl, "unquote")) {
+    if (is_call_to(xl, SymUnquote)) {
         REQUIRE(x, xl.size() == 2);
         return xl[1];
     }
-    else if (is_pair(xl[0]) && is_call_to(get<sexprs>(xl[0]), "unquote-splicing")) {
-        auto& xl0 = get<sexprs>(xl[0]);
+    else if (is_pair(xl[0]) && is_call_to(get<sexpr_list>(xl[0]), SymUnquoteSplicing)) {
+        auto& xl0 = get<sexpr_list>(xl[0]);
         REQUIRE(xl0, xl0.size() == 2);
         return make_list(symbol("append"),
                          xl0[1],
-                         expand_quasiquote(cdr(xl)));
+                         expand_quasiquote(xl.cdr()));
     }
     else {
         return make_list(symbol("cons"),
                          expand_quasiquote(xl[0]),
-                         expand_quasiquote(cdr(xl)));
+                         expand_quasiquote(xl.cdr()));
+    }
+}
+
+// the variables of a fn as seen by resolve(): arguments, then any
+// names defined with : in the body
+struct scope {
+    scope(const sexprs& names, const scope* parent)
+        : _names(names), _parent(parent) {
+    }
+    sexprs _names;
+    const scope* _parent;
+};
+
+// true if x makes a closure, which could capture the frame x runs in
+bool makes_closure(const sexpr& x) {
+    auto xl = get<sexpr_list>(&x);
+    if (!xl || xl->empty())
+        return false;
+    const int form = form_of(*xl);
+    if (form == SymQuote)
+        return false;
+    if (form == SymFn)
+        return true;
+    for (auto& e : *xl)
+        if (makes_closure(e))
+            return true;
+    return false;
+}
+
+void collect_locals(const sexpr& x, sexprs& names) {
+    auto xl = get<sexpr_list>(&x);
+    if (!xl || xl->empty())
+        return;
+    const int form = form_of(*xl);
+    if (form == SymQuote || form == SymFn)
+        return;
+    if (form == SymDefine && xl->size() == 3) {
+        const symbol* s = get<symbol>(get<atom>(&(*xl)[1]));
+        if (s && index_of(names, *s) < 0)
+            names.push_back((*xl)[1]);
+    }
+    for (auto& e : *xl)
+        collect_locals(e, names);
+}
+
+// lexical addressing pass, run on expanded code: turns every variable
+// reference into a localref (frame depth, slot index) or a globalref,
+// and appends the frame layout of each fn to it, its arguments
+// followed by its locals, and whether its frames can be captured.
+// a fn that def or : binds also gets the name, for the profiler:
+// (fn (args) body (names) captured [name])
+sexpr resolve(const sexpr& x, const scope* sc) {
+    if (const symbol* sym = get<symbol>(get<atom>(&x))) {
+        unsigned depth = 0;
+        for (const scope* s = sc; s; s = s->_parent, ++depth) {
+            int i = index_of(s->_names, *sym);
+            if (i >= 0)
+                return localref(depth, i, *sym);
+        }
+        return globalref(*sym, global_env()->cell(*sym));
+    }
+    auto xl = get<sexpr_list>(&x);
+    if (!xl || xl->empty())
+        return x;
+    const sexpr_list& v = *xl;
+
+    const int form = form_of(v);
+    switch (form) {
+    case SymQuote:
+        return x;
+    case SymDefine:
+    case SymDef: {
+        sexpr value = resolve(v[2], sc);
+        auto fn = get<sexpr_list>(&value);
+        if (fn && is_call_to(*fn, SymFn)) {
+            sexprs named(fn->begin(), fn->end());
+            named.push_back(v[1]);
+            value = sexpr_list(named);
+        }
+        if (!sc) // top level definitions go into the global table
+            return make_list(v[0], v[1], value);
+        return make_list(v[0], resolve(v[1], sc), value);
+    }
+    case SymFn: {
+        const sexpr_list& vars = get<sexpr_list>(v[1]);
+        sexprs names(vars.begin(), vars.end());
+        if (is_variadic(vars))
+            names.pop_back();
+        collect_locals(v[2], names);
+        scope inner(names, sc);
+        sexpr captured = sexpr_list();
+        if (makes_closure(v[2]))
+            captured = atom(symbol(SymT));
+        return make_list(v[0], vars, resolve(v[2], &inner), sexpr_list(names), captured);
+    }
+    }
+
+    sexprs ret;
+    ret.reserve(v.size());
+    auto i = v.begin();
+    if (form == SymIf || form == SymSet || form == SymDo)
+        ret.push_back(*i++);
+    for (; i != v.end(); ++i)
+        ret.push_back(resolve(*i, sc));
+    return sexpr_list(ret);
+}
+
+namespace {
+    // what eval does with the value of a subexpression once it has it
+    enum kont_type {
+        KIf,        // pick a branch of _form
+        KSetLocal,  // assign it to the variable of _form
+        KSetGlobal,
+        KSetName,
+        KDefine,
+        KDo,        // carry on with the body at _next
+        KCall,      // push it, carry on with the argument at _next
+    };
+
+    struct kont {
+        kont(kont_type type, const sexpr_list& form, const envptr& env)
+            : _type(type), _form(form), _next(), _env(env), _base(0) {
+        }
+        kont_type _type;
+        sexpr_list _form;
+        sexpr_list::const_iterator _next;
+        envptr _env;
+        size_t _base; // where the callee and arguments of a call start in vals
+    };
+
+    // the value of x if it takes no evaluating, or null
+    const sexpr* simple_value(const sexpr& x, environment& env) {
+        if (auto r = get<localref>(&x))
+            return &env[*r];
+        if (auto r = get<globalref>(&x))
+            return &global_value(*r);
+        if (auto a = get<atom>(&x))
+            if (!get<symbol>(a))
+                return &x;
+        return nullptr;
+    }
+
+    // what the profiler sees of an eval loop
+    struct eval_frames {
+        const vector<kont>& _konts;
+        const envptr& _env;
+    };
+
+    void walk_eval(const void* state, vector<const environment*>& frames) {
+        const eval_frames& s = *(const eval_frames*)state;
+        for (auto& k : s._konts)
+            frames.push_back(k._env.get());
+        frames.push_back(s._env.get());
     }
 }
 
+// the continuation of the expression being evaluated is kept in
+// konts rather than on the C++ stack, so how deep a program can
+// recurse is up to max_depth and memory. evaluated callees and
+// arguments wait in vals until the call is made
 sexpr eval(sexpr x, envptr env) {
+    vector<kont> konts;
+    sexprs vals;
+    sexpr value;
+    const eval_frames frames = { konts, env };
+    profiled_run self(walk_eval, &frames);
     while (true) {
-        if (auto a = get<atom>(&x)) {
-            if (auto s = get<symbol>(a)) {
-                return env->find(*s)[*s];
-            }
-            return *a;
+        STAT(evals);
+        // evaluate x, or push what to do with the value of
+        // the subexpression it needs first and evaluate that
+        if (auto r = get<localref>(&x)) {
+            value = (*env)[*r];
         }
-        else if (auto v = get<sexprs>(&x)) {
-            if (v->size() == 0) {
-                return x;
-            }
-            else if (is_call_to(*v, "quote")) {
-                return (*v)[1];
+        else if (auto r = get<globalref>(&x)) {
+            value = global_value(*r);
+        }
+        else if (auto a = get<atom>(&x)) {
+            if (auto s = get<symbol>(a))
+                value = env->find(*s)[*s];
+            else
+                value = *a;
+        }
+        else if (auto l = get<sexpr_list>(&x)) {
+            // x is reassigned below, once v is held by a kont
+            const sexpr_list& v = *l;
+            if (v.empty()) {
+                value = x;
             }
-            else if (is_call_to(*v, "if")) {
-                auto& test = (*v)[1];
-                auto& conseq = (*v)[2];
-                auto& alt = (*v)[3];
-                if (truth(eval(test, env))) {
-                    x = conseq;
+            else {
+                bool pushed = true;
+                switch (form_of(v)) {
+                case SymQuote:
+                    value = v[1];
+                    pushed = false;
+                    break;
+                case SymIf:
+                    konts.emplace_back(KIf, v, env);
+                    x = v[1];
+                    break;
+                case SymSet: {
+                    auto& var = v[1];
+                    kont_type type = KSetName;
+                    if (get<localref>(&var))
+                        type = KSetLocal;
+                    else if (get<globalref>(&var))
+                        type = KSetGlobal;
+                    konts.emplace_back(type, v, env);
+                    x = v[2];
+                    break;
                 }
-                else {
-                    x = alt;
+                case SymDefine:
+                case SymDef:
+                    konts.emplace_back(KDefine, v, env);
+                    x = v[2];
+                    break;
+                case SymFn: {
+                    auto& vars = get<sexpr_list>(v[1]);
+                    auto& exp = v[2];
+                    if (v.size() > 4)
+                        value = make_procedure(vars, exp, env, get<sexpr_list>(v[3]), truth(v[4]), fn_name(v));
+                    else
+                        value = make_procedure(vars, exp, env, sexpr_list(), true, symbol(SymFn));
+                    pushed = false;
+                    break;
+                }
+                case SymDo: {
+                    const sexpr_list& body = v.cdr();
+                    if (body.empty()) {
+                        value = sexpr_list();
+                        pushed = false;
+                        break;
+                    }
+                    auto i = body.begin();
+                    if (++i != body.end()) {
+                        konts.emplace_back(KDo, v, env);
+                        konts.back()._next = i;
+                    }
+                    // the last expression is in tail position
+                    sexpr first = body.front();
+                    x = std::move(first);
+                    continue;
+                }
+                default:
+                    konts.emplace_back(KCall, v, env);
+                    konts.back()._next = ++v.begin();
+                    konts.back()._base = vals.size();
+                    if (const sexpr* y = simple_value(v.front(), *env)) {
+                        value = *y;
+                        pushed = false;
+                        check_depth(konts.size());
+                        break;
+                    }
+                    x = v.front();
+                    break;
+                }
+                if (pushed) {
+                    check_depth(konts.size());
+                    continue;
                 }
             }
-            else if (is_call_to(*v, "=")) {
-                auto& var = (*v)[1];
-                auto& exp = (*v)[2];
-                env->find(var)[var] = eval(exp, env);
-                return var;
-            }
-            else if (is_call_to(*v, ":")) {
-                auto& var = (*v)[1];
-                auto& exp = (*v)[2];
-                (*env)[var] = eval(exp, env);
-                return var;
-            }
-            else if (is_call_to(*v, "def")) {
-                auto& var = (*v)[1];
-                auto& exp = (*v)[2];
-                (*env)[var] = eval(exp, env);
-                return var;
+        }
+        else {
+            value = x; // values spliced into code by macros
+        }
+
+        // hand the value to the innermost continuation
+        while (true) {
+            if (konts.empty())
+                return value;
+            kont& k = konts.back();
+            const sexpr_list& v = k._form;
+            switch (k._type) {
+            case KIf:
+                x = truth(value) ? v[2] : v[3];
+                env = std::move(k._env);
+                konts.pop_back();
+                break;
+            case KSetLocal: {
+                auto& r = get<localref>(v[1]);
+                (*k._env)[r] = std::move(value);
+                value = atom(r._name);
+                konts.pop_back();
+                continue;
             }
-            else if (is_call_to(*v, "fn")) {
-                auto& vars = get<sexprs>((*v)[1]);
-                auto& exp = (*v)[2];
-                return make_procedure(vars, exp, env);
+            case KSetGlobal: {
+                auto& r = get<globalref>(v[1]);
+                global_value(r) = std::move(value);
+                value = atom(r._name);
+                konts.pop_back();
+                continue;
             }
-            else if (is_call_to(*v, "do")) {
-                for (size_t i = 1; i < v->size()-1; ++i) {
-                    eval((*v)[i] , env);
+            case KSetName:
+                k._env->find(v[1])[v[1]] = std::move(value);
+                value = v[1];
+                konts.pop_back();
+                continue;
+            case KDefine:
+                if (auto r = get<localref>(&v[1])) {
+                    (*k._env)[*r] = std::move(value);
+                    value = atom(r->_name);
                 }
-                if (v->size() > 1)
-                    x = v->back();
-                else
-                    return sexprs();
-            }
-            else {
-                const size_t vsz = v->size();
-                sexpr fn = eval((*v)[0], env);
-                sexprs exps;
-                exps.reserve(vsz);
-                for (size_t i = 1; i < vsz; ++i)
-                    exps.push_back(eval((*v)[i], env));
-                if (auto l = get<builtin>(&fn)) {
-                    return (*l)(&exps);
+                else {
+                    (*k._env)[v[1]] = std::move(value);
+                    value = v[1];
                 }
-                else if (auto p = get<procedure_ptr>(&fn)) {
-                    const auto& proc = *(*p);
-                    proc.variadic(exps);
-                    x = proc._exp;
-                    env = envptr(new environment(proc._vars, exps, proc._parent));
+                konts.pop_back();
+                continue;
+            case KDo:
+                x = *k._next;
+                env = k._env;
+                if (++k._next == v.end())
+                    konts.pop_back();
+                break;
+            case KCall:
+                vals.push_back(std::move(value));
+                for (; k._next != v.end(); ++k._next) {
+                    const sexpr* y = simple_value(*k._next, *k._env);
+                    if (!y)
+                        break;
+                    vals.push_back(*y);
                 }
-                else
+                if (k._next != v.end()) {
+                    x = *k._next++;
+                    env = k._env;
+                    break;
+                }
+                else {
+                    const size_t base = k._base;
+                    const size_t n = vals.size() - base - 1;
+                    konts.pop_back();
+                    sexpr fn = std::move(vals[base]);
+                    if (auto l = get<builtin>(&fn)) {
+                        // a builtin that evaluates runs an eval of its
+                        // own, so vals stays put while it has a span over it
+                        value = (*l)(sexpr_span(n ? &vals[base + 1] : nullptr, n));
+                        vals.erase(vals.begin() + base, vals.end());
+                        continue;
+                    }
+                    if (auto p = get<procedure_ptr>(&fn)) {
+                        const auto& proc = *(*p);
+                        x = proc._exp;
+                        // let go of the caller's frame first, so a tail
+                        // call can reuse its place on the frame stack
+                        env = envptr();
+                        env = make_frame(proc, n ? &vals[base + 1] : nullptr, n);
+                        vals.erase(vals.begin() + base, vals.end());
+                        if (profile_due)
+                            profile_sample();
+                        break;
+                    }
                     throw runtime_error("not callable");
+                }
             }
+            break;
         }
     }
 }
 
-struct pratom2s : public static_visitor<string> {
-    string operator()(const string& value) const { return value; }
-    string operator()(const symbol& value) const { return value; }
-    string operator()(double value) const {
-        return lexical_cast<string>(value);
+sexpr apply(const sexpr& fn, sexprs& args) {
+    if (auto l = get<builtin>(&fn)) {
+        return (*l)(args);
     }
-};
+    else if (auto p = get<procedure_ptr>(&fn)) {
+        if (interpreter::current->_engine == Bytecode)
+            return vm_apply(*p, args);
+        const auto& proc = *(*p);
+        envptr env = make_frame(proc, args.data(), args.size());
+        return eval(proc._exp, env);
+    }
+    throw runtime_error("not callable");
+}
+
+sexpr exec(const sexpr& x, const envptr& env) {
+    if (interpreter::current->_engine == Bytecode)
+        return vm_eval(x, env);
+    return eval(x, env);
+}
+
+void repl(istream& in, bool prompt, bool out);
+
+namespace {
+    // run the top level form that form() returns, reporting errors
+    // rather than passing them on
+    template <typename Form>
+    void run_toplevel(Form form, bool out) {
+        try {
+            sexpr exp = exec(form(), global_env());
+            global_env()->add("_", exp);
+            if (out)
+                printer(cout).write(exp).put('\n');
+        }
+        // cout is left unflushed until input is read, but what it
+        // has so far goes out before the error does
+        catch (bad_get& e) {
+            cout.flush();
+            cerr << "type mismatch: " << diagnostic_information(e) << endl;
+        }
+        catch (boost::exception& e) {
+            cout.flush();
+            cerr << "error: " << diagnostic_information(e) << endl;
+        }
+        catch (std::exception& e) {
+            cout.flush();
+            cerr << "error: " << e.what() << endl;
+        }
+    }
+
+    // load() keeps the expanded forms of a file in a cache file next
+    // to it, which is used for as long as the file stays the same.
+    // forms that define macros are kept as read and expanded again,
+    // since expanding them is what defines the macro. the cache
+    // assumes that macros the file uses from elsewhere don't change
+
+    const char CacheMagic[] = "k11 load cache 1\n";
+
+    enum cached_form { CachedExpanded, CachedSource };
+
+    struct source_key {
+        uint64_t _mtime;
+        uint64_t _size;
+        uint64_t _hash; // fnv-1a of the contents
+    };
 
-struct prsexpr2s : public static_visitor<string> {
-    string operator()(const atom& a) const {
-        return apply_visitor(pratom2s(), a);
+    source_key key_of(const string& fname, string_ref text) {
+        source_key key = { 0, text.size(), 14695981039346656037ull };
+        struct stat st;
+        if (stat(fname.c_str(), &st) == 0)
+            key._mtime = (uint64_t)st.st_mtime;
+        for (unsigned char ch : text) {
+            key._hash ^= ch;
+            key._hash *= 1099511628211ull;
+        }
+        return key;
     }
-    string operator()(const builtin& fn) const { return "<builtin>"; }
-    string operator()(const procedure_ptr& fn) const { return "<fn>"; }
 
-    string operator()(const sexprs& v) const {
-        if (v.size() == 0)
-            return "()";
-        stringstream ss;
-        ss << "("
-           << util::mapjoin(" ", v.begin(), v.end(), [](const sexpr& s) {
-                   return apply_visitor(sexpr2s(), s);
-               })
-           << ")";
-        return ss.str();
+    string cache_name(const string& fname) {
+        return fname + ".k11c";
     }
-};
 
-string pr_to_str(const sexpr& l) {
-    return apply_visitor(prsexpr2s(), l);
-}
+    // where a cache is written before it's renamed into place, apart
+    // for every write so interpreters loading the same file at once
+    // don't write over each other
+    string temp_name(const string& fname) {
+        static atomic<unsigned> writes(0);
+        ostringstream s;
+        s << cache_name(fname) << ".tmp." << getpid() << "." << writes++;
+        return s.str();
+    }
 
-void repl(istream& in, bool prompt, bool out);
+    // run the forms cached for fname, false if there is no cache for
+    // it as it is now
+    bool load_cached(const string& fname, const source_key& key) {
+        ifstream f(cache_name(fname).c_str(), ios::binary);
+        if (!f.is_open())
+            return false;
+        vector<pair<uint64_t, sexpr> > forms;
+        try {
+            char magic[sizeof CacheMagic - 1];
+            if (!f.read(magic, sizeof magic) || memcmp(magic, CacheMagic, sizeof magic) != 0)
+                return false;
+            sexpr_reader r(f);
+            if (r.read_varint() != key._mtime || r.read_varint() != key._size || r.read_varint() != key._hash)
+                return false;
+            for (uint64_t n = r.read_varint(); n > 0; --n) {
+                const uint64_t kind = r.read_varint();
+                forms.push_back(make_pair(kind, r.read()));
+            }
+        }
+        catch (serial_error&) {
+            return false;
+        }
+        for (auto& form : forms) {
+            run_toplevel([&] {
+                if (form.first == CachedSource)
+                    return compile_toplevel(expand(form.second, true));
+                return compile_toplevel(form.second);
+            }, false);
+        }
+        return true;
+    }
+
+    void write_cache(const string& fname, const source_key& key,
+                     const vector<pair<uint64_t, sexpr> >& forms) {
+        const string tmp = temp_name(fname);
+        try {
+            ofstream f(tmp.c_str(), ios::binary | ios::trunc);
+            if (!f.is_open())
+                return;
+            f.write(CacheMagic, sizeof CacheMagic - 1);
+            sexpr_writer w(f);
+            w.write_varint(key._mtime);
+            w.write_varint(key._size);
+            w.write_varint(key._hash);
+            w.write_varint(forms.size());
+            for (auto& form : forms) {
+                w.write_varint(form.first);
+                w.write(form.second);
+            }
+            f.close();
+            if (f && rename(tmp.c_str(), cache_name(fname).c_str()) == 0)
+                return;
+        }
+        catch (serial_error&) {
+            // code with values in it that only exist at run time
+        }
+        remove(tmp.c_str());
+    }
+
+    // read, expand and run the forms of fname, caching them if
+    // they all expand
+    void load_source(const string& fname, string_ref text, const source_key& key) {
+        vector<pair<uint64_t, sexpr> > forms;
+        bool cacheable = interpreter::current->_use_load_cache;
+        read_forms(text.begin(), text.end(), [&](const read_result& r) {
+            bool expanded = false;
+            run_toplevel([&] {
+                if (r._error)
+                    rethrow_exception(r._error);
+                const sexpr& x = r._form;
+                const unsigned macros = interpreter::current->_macro_definitions;
+                sexpr e = expand(x, true);
+                if (interpreter::current->_macro_definitions != macros)
+                    forms.push_back(make_pair((uint64_t)CachedSource, x));
+                else
+                    forms.push_back(make_pair((uint64_t)CachedExpanded, e));
+                expanded = true;
+                return compile_toplevel(e);
+            }, false);
+            cacheable = cacheable && expanded;
+        });
+        if (cacheable)
+            write_cache(fname, key, forms);
+    }
+}
 
 namespace {
-    sexpr addfn(const sexprs& args) {
-        double sum = 0.0;
-        for (auto v : args)
-            sum += get<double>(get<atom>(v));
+    // overflow checks for the fixnum paths, on overflow the
+    // arithmetic continues in double
+    bool add_overflows(fixnum a, fixnum b, fixnum* r) {
+        return __builtin_add_overflow(a, b, r);
+    }
+
+    bool sub_overflows(fixnum a, fixnum b, fixnum* r) {
+        return __builtin_sub_overflow(a, b, r);
+    }
+
+    bool mul_overflows(fixnum a, fixnum b, fixnum* r) {
+        return __builtin_mul_overflow(a, b, r);
+    }
+
+    // folds op over args, in fixnums for as long as the
+    // arguments are fixnums and op doesn't overflow
+    template <typename Overflows, typename Op>
+    sexpr fold_numbers(const sexpr* i, const sexpr* end,
+                       fixnum acc, Overflows overflows, Op op) {
+        for (; i != end; ++i) {
+            auto n = get<fixnum>(&get<atom>(*i));
+            fixnum r;
+            if (!n || overflows(acc, *n, &r))
+                break;
+            acc = r;
+        }
+        if (i == end)
+            return atom(acc);
+        double sum = (double)acc;
+        for (; i != end; ++i)
+            sum = op(sum, to_double(get<atom>(*i)));
         return atom(sum);
     }
 
-    sexpr subfn(const sexprs& args) {
+    sexpr addfn(sexpr_span args) {
+        return fold_numbers(args.begin(), args.end(), (fixnum)0, add_overflows,
+                            [](double a, double b) { return a + b; });
+    }
+
+    sexpr subfn(sexpr_span args) {
         if (args.size() == 1)
-            return atom(-get<double>(get<atom>(args.front())));
-        auto i = args.begin();
-        double sum = get<double>(get<atom>(*i++));
-        for (; i != args.end(); ++i)
-            sum -= get<double>(get<atom>(*i));
+            return fold_numbers(args.begin(), args.end(), (fixnum)0, sub_overflows,
+                                [](double a, double b) { return a - b; });
+        const atom& first = get<atom>(args.front());
+        if (auto n = get<fixnum>(&first))
+            return fold_numbers(args.begin() + 1, args.end(), *n, sub_overflows,
+                                [](double a, double b) { return a - b; });
+        double sum = get<double>(first);
+        for (auto i = args.begin() + 1; i != args.end(); ++i)
+            sum -= to_double(get<atom>(*i));
         return atom(sum);
     }
 
-    sexpr mulfn(const sexprs& args) {
-        auto i = args.begin();
-        double sum = get<double>(get<atom>(*i++));
-        for (; i != args.end(); ++i)
-            sum *= get<double>(get<atom>(*i));
-        return atom(sum);
+    sexpr mulfn(sexpr_span args) {
+        return fold_numbers(args.begin(), args.end(), (fixnum)1, mul_overflows,
+                            [](double a, double b) { return a * b; });
     }
 
-    sexpr divfn(const sexprs& args) {
+    // stays exact while the divisions do
+    sexpr divfn(sexpr_span args) {
         auto i = args.begin();
-        double sum = get<double>(get<atom>(*i++));
+        const atom& first = get<atom>(*i++);
+        if (auto n = get<fixnum>(&first)) {
+            fixnum q = *n;
+            for (; i != args.end(); ++i) {
+                auto d = get<fixnum>(&get<atom>(*i));
+                if (!d || *d == 0 || (*d == -1 && q == INT64_MIN) || q % *d != 0)
+                    break;
+                q /= *d;
+            }
+            if (i == args.end())
+                return atom(q);
+            double sum = (double)q;
+            for (; i != args.end(); ++i)
+                sum /= to_double(get<atom>(*i));
+            return atom(sum);
+        }
+        double sum = get<double>(first);
         for (; i != args.end(); ++i)
-            sum /= get<double>(get<atom>(*i));
+            sum /= to_double(get<atom>(*i));
         return atom(sum);
     }
 
     sexpr notfn(const sexpr& arg) {
         if (truth(arg))
-            return sexprs();
-        return atom(symbol("t"));
+            return sexpr_list();
+        return atom(symbol(SymT));
+    }
+
+    sexpr listfn(sexpr_span args) {
+        return sexpr_list(args.begin(), args.end());
     }
 
-    sexpr listfn(const sexprs& args) {
-        return args;
+    sexpr lenfn(const sexpr& x) {
+        if (auto a = get<atom>(&x))
+            return atom((fixnum)get<string>(*a).size());
+        return atom((fixnum)get<sexpr_list>(x).size());
     }
 
-    sexpr lenfn(const sexpr& lst) {
-        return atom((double)get<sexprs>(lst).size());
+    sexpr string_appendfn(sexpr_span args) {
+        size_t n = 0;
+        for (auto& x : args)
+            n += get<string>(get<atom>(x)).size();
+        string s;
+        s.reserve(n);
+        for (auto& x : args)
+            s += get<string>(get<atom>(x));
+        return atom(s);
     }
 
     sexpr carfn(const sexpr& arg) {
-        const auto& l = get<sexprs>(arg);
-        if (l.size() > 0)
+        const auto& l = get<sexpr_list>(arg);
+        if (!l.empty())
             return l.front();
         return l;
     }
 
     sexpr cdrfn(const sexpr& arg) {
-        const auto& l = get<sexprs>(arg);
-        if (l.size() > 0)
-            return sexprs(++l.begin(), l.end());
-        return l;
+        return get<sexpr_list>(arg).cdr();
     }
 
-    sexpr consfn(const sexprs& args) {
+    sexpr consfn(sexpr_span args) {
+        if (args.size() != 2)
+            throw runtime_error("bad arity");
         auto i = args.begin();
         const auto& consing = *i++;
-        const auto& lst = get<sexprs>(*i);
-        sexprs ret;
-        ret.reserve(lst.size()+1);
-        ret.push_back(consing);
-        ret.insert(ret.end(), lst.begin(), lst.end());
-        return ret;
-    }
-
-    sexpr appendfn(const sexprs& args) {
-        auto i = args.begin();
-        auto lst = get<sexprs>(*i++);
-        for (; i != args.end(); ++i) {
-            const auto& lst2 = get<sexprs>(*i);
-            lst.insert(lst.end(), lst2.begin(), lst2.end());
+        return sexpr_list(consing, get<sexpr_list>(*i));
+    }
+
+    // copies all but the last list, which the result shares
+    sexpr appendfn(sexpr_span args) {
+        if (args.empty())
+            return sexpr_list();
+        auto i = args.end();
+        sexpr_list lst = get<sexpr_list>(*--i);
+        while (i != args.begin()) {
+            const auto& lst2 = get<sexpr_list>(*--i);
+            sexprs head(lst2.begin(), lst2.end());
+            for (auto j = head.rbegin(); j != head.rend(); ++j)
+                lst = sexpr_list(*j, lst);
         }
         return lst;
     }
 
     sexpr listpfn(const sexpr& arg) {
-        auto lst = get<sexprs>(&arg);
-        return lst ? *lst : sexprs();
+        auto lst = get<sexpr_list>(&arg);
+        return lst ? *lst : sexpr_list();
     }
     sexpr nullpfn(const sexpr& arg) {
-        auto lst = get<sexprs>(&arg);
-        if (lst && lst->size() == 0)
-            return atom(symbol("t"));
-        return sexprs();
+        auto lst = get<sexpr_list>(&arg);
+        if (lst && lst->empty())
+            return atom(symbol(SymT));
+        return sexpr_list();
     }
     sexpr symbolpfn(const sexpr& arg) {
         auto a = get<atom>(&arg);
         if (a && get<symbol>(a))
             return *a;
-        return sexprs();
+        return sexpr_list();
     }
 
     sexpr defvarfn(const sexpr& var, const sexpr& exp) {
-        (*global_env)[var] = eval(exp, global_env);
+        (*global_env())[var] = eval(exp, global_env());
         return var;
     }
 
+    sexpr deepestfn() {
+        return atom((fixnum)interpreter::current->_deepest);
+    }
+
     sexpr envfn() {
-        for (const auto& e : global_env->_env)
-            cout << e.first << "\t=\t" << to_str(e.second) << "\n";
-        return sexprs();
+        printer p(cout);
+        for (const auto& e : global_env()->_env)
+            if (e.second._bound)
+                p.put(e.first.str()).put("\t=\t", 3).write(e.second._value).put('\n');
+        return sexpr_list();
     }
 
     // TODO: generalize to non-numeric types
 
+    // exact on two fixnums, otherwise compares as doubles
+    template <typename Cmp>
+    bool compare_numbers(const atom& a, const atom& b, Cmp cmp) {
+        auto i = get<fixnum>(&a);
+        auto j = get<fixnum>(&b);
+        if (i && j)
+            return cmp(*i, *j);
+        return cmp(to_double(a), to_double(b));
+    }
+
+    struct num_less {
+        template <typename T> bool operator()(T a, T b) const { return a < b; }
+    };
+    struct num_greater {
+        template <typename T> bool operator()(T a, T b) const { return a > b; }
+    };
+    struct num_less_equal {
+        template <typename T> bool operator()(T a, T b) const { return a <= b; }
+    };
+    struct num_greater_equal {
+        template <typename T> bool operator()(T a, T b) const { return a >= b; }
+    };
+    struct num_equal {
+        template <typename T> bool operator()(T a, T b) const { return a == b; }
+    };
+
     sexpr ltfn(const sexpr& a, const sexpr& b) {
-        if (get<double>(get<atom>(a)) < get<double>(get<atom>(b)))
-            return atom(symbol("t"));
-        return sexprs();
+        if (compare_numbers(get<atom>(a), get<atom>(b), num_less()))
+            return atom(symbol(SymT));
+        return sexpr_list();
     }
 
     sexpr gtfn(const sexpr& a, const sexpr& b) {
-        if (get<double>(get<atom>(a)) > get<double>(get<atom>(b)))
-            return atom(symbol("t"));
-        return sexprs();
+        if (compare_numbers(get<atom>(a), get<atom>(b), num_greater()))
+            return atom(symbol(SymT));
+        return sexpr_list();
     }
 
     sexpr lteqfn(const sexpr& a, const sexpr& b) {
-        if (get<double>(get<atom>(a)) <= get<double>(get<atom>(b)))
-            return atom(symbol("t"));
-        return sexprs();
+        if (compare_numbers(get<atom>(a), get<atom>(b), num_less_equal()))
+            return atom(symbol(SymT));
+        return sexpr_list();
     }
 
     sexpr gteqfn(const sexpr& a, const sexpr& b) {
-        if (get<double>(get<atom>(a)) >= get<double>(get<atom>(b)))
-            return atom(symbol("t"));
-        return sexprs();
+        if (compare_numbers(get<atom>(a), get<atom>(b), num_greater_equal()))
+            return atom(symbol(SymT));
+        return sexpr_list();
+    }
+
+    bool is_number(const atom& a) {
+        return get<fixnum>(&a) || get<double>(&a);
+    }
+
+    // numbers are equal by value, so (= 1 1.0) holds
+    bool atoms_equal(const atom& a, const atom& b) {
+        if (is_number(a) && is_number(b))
+            return compare_numbers(a, b, num_equal());
+        return a == b;
     }
 
     sexpr eqfn(const sexpr& a0, const sexpr& a1) {
-        if (get<atom>(a0) == get<atom>(a1))
-            return atom(symbol("t"));
-        return sexprs();
+        if (atoms_equal(get<atom>(a0), get<atom>(a1)))
+            return atom(symbol(SymT));
+        return sexpr_list();
     }
 
     sexpr neqfn(const sexpr& a0, const sexpr& a1) {
-        if (get<atom>(a0) == get<atom>(a1))
-            return sexprs();
-        return atom(symbol("t"));
+        if (atoms_equal(get<atom>(a0), get<atom>(a1)))
+            return sexpr_list();
+        return atom(symbol(SymT));
     }
 
-    sexpr prfn(const sexprs& args) {
+    sexpr prfn(sexpr_span args) {
         if (args.size() == 0)
-            return args;
+            return sexpr_list();
+        printer p(cout);
         for (auto i = args.begin(); i != args.end(); ++i)
-            cout << pr_to_str(*i);
+            p.display(*i);
         return *args.begin();
     }
 
+    sexpr tablefn(sexpr_span args) {
+        if (args.size() % 2 != 0)
+            throw runtime_error("table needs a value for each key");
+        table_ptr t(new table);
+        for (size_t i = 0; i < args.size(); i += 2)
+            t->set(get<atom>(args[i]), args[i + 1]);
+        return t;
+    }
+
+    sexpr vectorfn(sexpr_span args) {
+        vector_ptr v(new sexpr_vector);
+        v->_items.assign(args.begin(), args.end());
+        return v;
+    }
+
+    sexpr& vector_item(sexpr_vector& v, const sexpr& index) {
+        const fixnum i = get<fixnum>(get<atom>(index));
+        if (i < 0 || (size_t)i >= v._items.size())
+            throw runtime_error("index out of range");
+        return v._items[i];
+    }
+
+    double& f64vector_item(f64vector& v, const sexpr& index) {
+        const fixnum i = get<fixnum>(get<atom>(index));
+        if (i < 0 || (size_t)i >= v._data.size())
+            throw runtime_error("index out of range");
+        return v._data[i];
+    }
+
+    // (get c k) is the value for the key k of a table, or () if
+    // there is none, or the item at index k of a vector
+    sexpr getfn(const sexpr& c, const sexpr& k) {
+        if (auto v = get<vector_ptr>(&c))
+            return vector_item(**v, k);
+        if (auto v = get<f64vector_ptr>(&c))
+            return atom(f64vector_item(**v, k));
+        const sexpr* x = get<table_ptr>(c)->find(get<atom>(k));
+        return x ? *x : sexpr_list();
+    }
+
+    sexpr setfn(const sexpr& c, const sexpr& k, const sexpr& x) {
+        if (auto v = get<vector_ptr>(&c))
+            vector_item(**v, k) = x;
+        else if (auto v = get<f64vector_ptr>(&c))
+            f64vector_item(**v, k) = to_double(get<atom>(x));
+        else
+            get<table_ptr>(c)->set(get<atom>(k), x);
+        return x;
+    }
+
+    sexpr haspfn(const sexpr& c, const sexpr& k) {
+        bool has;
+        if (auto v = get<vector_ptr>(&c)) {
+            const fixnum i = get<fixnum>(get<atom>(k));
+            has = i >= 0 && (size_t)i < (*v)->_items.size();
+        }
+        else if (auto v = get<f64vector_ptr>(&c)) {
+            const fixnum i = get<fixnum>(get<atom>(k));
+            has = i >= 0 && (size_t)i < (*v)->_data.size();
+        }
+        else {
+            has = get<table_ptr>(c)->find(get<atom>(k)) != nullptr;
+        }
+        if (has)
+            return atom(symbol(SymT));
+        return sexpr_list();
+    }
+
+    sexpr sizefn(const sexpr& c) {
+        if (auto v = get<vector_ptr>(&c))
+            return atom((fixnum)(*v)->_items.size());
+        if (auto v = get<f64vector_ptr>(&c))
+            return atom((fixnum)(*v)->_data.size());
+        return atom((fixnum)get<table_ptr>(c)->size());
+    }
+
+    sexpr keysfn(const sexpr& c) {
+        sexprs keys;
+        get<table_ptr>(c)->each([&](const atom& k, const sexpr&) {
+            keys.push_back(k);
+        });
+        return sexpr_list(keys);
+    }
+
+    // a table of the counts in stats.hpp so far, for scripts to
+    // compare before and after
+    sexpr eval_statsfn() {
+#ifdef SCHEME_STATS
+        const eval_stats s = current_stats();
+        table_ptr t(new table);
+        t->set(symbol("evals"), atom((fixnum)s._evals));
+        t->set(symbol("calls"), atom((fixnum)s._calls));
+        t->set(symbol("builtin-calls"), atom((fixnum)s._builtin_calls));
+        t->set(symbol("environments"), atom((fixnum)s._environments));
+        t->set(symbol("find-steps"), atom((fixnum)s._find_steps));
+        t->set(symbol("allocations"), atom((fixnum)s._allocations));
+        t->set(symbol("allocated-bytes"), atom((fixnum)s._allocated_bytes));
+        t->set(symbol("expansions"), atom((fixnum)s._expansions));
+        return t;
+#else
+        throw runtime_error("eval-stats: built without SCHEME_STATS");
+#endif
+    }
+
+    f64vector_ptr new_f64vector(size_t n) {
+        f64vector_ptr v(new f64vector);
+        v->_data.resize(n);
+        return v;
+    }
+
+    sexpr f64vectorfn(sexpr_span args) {
+        f64vector_ptr v = new_f64vector(args.size());
+        for (size_t i = 0; i < args.size(); ++i)
+            v->_data[i] = to_double(get<atom>(args[i]));
+        return v;
+    }
+
+    // (make-f64vector n) or (make-f64vector n fill)
+    sexpr make_f64vectorfn(sexpr_span args) {
+        if (args.size() != 1 && args.size() != 2)
+            throw runtime_error("bad arity");
+        const fixnum n = get<fixnum>(get<atom>(args[0]));
+        if (n < 0)
+            throw runtime_error("negative size");
+        f64vector_ptr v = new_f64vector(n);
+        if (args.size() == 2)
+            fill(v->_data.begin(), v->_data.end(), to_double(get<atom>(args[1])));
+        return v;
+    }
+
+    const f64vector& f64vector_arg(const sexpr& x) {
+        return *get<f64vector_ptr>(x);
+    }
+
+    // elementwise arithmetic on two vectors of the same size
+    template <void (*Kernel)(const double*, const double*, double*, size_t)>
+    sexpr f64vector_op(const sexpr& a, const sexpr& b) {
+        const f64vector& x = f64vector_arg(a);
+        const f64vector& y = f64vector_arg(b);
+        if (x._data.size() != y._data.size())
+            throw runtime_error("vector sizes differ");
+        f64vector_ptr v = new_f64vector(x._data.size());
+        Kernel(x._data.data(), y._data.data(), v->_data.data(), x._data.size());
+        return v;
+    }
+
+    sexpr vscalefn(const sexpr& a, const sexpr& k) {
+        const f64vector& x = f64vector_arg(a);
+        f64vector_ptr v = new_f64vector(x._data.size());
+        f64_scale(x._data.data(), to_double(get<atom>(k)), v->_data.data(), x._data.size());
+        return v;
+    }
+
+    sexpr dotfn(const sexpr& a, const sexpr& b) {
+        const f64vector& x = f64vector_arg(a);
+        const f64vector& y = f64vector_arg(b);
+        if (x._data.size() != y._data.size())
+            throw runtime_error("vector sizes differ");
+        return atom(f64_dot(x._data.data(), y._data.data(), x._data.size()));
+    }
+
+    sexpr vsumfn(const sexpr& a) {
+        const f64vector& x = f64vector_arg(a);
+        return atom(f64_sum(x._data.data(), x._data.size()));
+    }
+
+    template <double (*Kernel)(const double*, size_t)>
+    sexpr f64vector_fold(const sexpr& a) {
+        const f64vector& x = f64vector_arg(a);
+        if (x._data.empty())
+            throw runtime_error("empty vector");
+        return atom(Kernel(x._data.data(), x._data.size()));
+    }
+
+    // the forms in a file as data, without running them
+    sexpr read_filefn(const sexpr& arg) {
+        const string& fname = get<string>(get<atom>(arg));
+        source_file f(fname);
+        if (!f.is_open())
+            throw runtime_error("file not found");
+        sexprs forms;
+        read_forms(f.data(), f.data() + f.size(), [&](const read_result& r) {
+            if (r._error)
+                rethrow_exception(r._error);
+            forms.push_back(r._form);
+        });
+        return sexpr_list(forms);
+    }
+
+    sexpr cosfn(const sexpr& v);
+    sexpr sinfn(const sexpr& v);
+    sexpr tanfn(const sexpr& v);
+    sexpr acosfn(const sexpr& v);
+    sexpr asinfn(const sexpr& v);
+    sexpr atanfn(const sexpr& v);
+
+    // the libm function behind a math builtin, or null
+    double (*math_of(const sexpr& fn))(double) {
+        auto l = get<builtin>(&fn);
+        if (!l || l->_arity != 1)
+            return nullptr;
+        if (l->_fn.f1 == cosfn) return cos;
+        if (l->_fn.f1 == sinfn) return sin;
+        if (l->_fn.f1 == tanfn) return tan;
+        if (l->_fn.f1 == acosfn) return acos;
+        if (l->_fn.f1 == asinfn) return asin;
+        if (l->_fn.f1 == atanfn) return atan;
+        return nullptr;
+    }
+
+    // (vmap fn v) applies fn to each number of v. the math builtins
+    // are run straight on the doubles, anything else gets each one
+    // boxed and has to return a number
+    sexpr vmapfn(const sexpr& fn, const sexpr& a) {
+        const f64vector& x = f64vector_arg(a);
+        f64vector_ptr v = new_f64vector(x._data.size());
+        if (double (*f)(double) = math_of(fn)) {
+            for (size_t i = 0; i < x._data.size(); ++i)
+                v->_data[i] = f(x._data[i]);
+            return v;
+        }
+        sexprs args(1);
+        for (size_t i = 0; i < x._data.size(); ++i) {
+            args[0] = atom(x._data[i]);
+            v->_data[i] = to_double(get<atom>(apply(fn, args)));
+        }
+        return v;
+    }
+
+    sexpr f64vectorpfn(const sexpr& x) {
+        if (get<f64vector_ptr>(&x))
+            return atom(symbol(SymT));
+        return sexpr_list();
+    }
+
+    sexpr tablepfn(const sexpr& x) {
+        if (get<table_ptr>(&x))
+            return atom(symbol(SymT));
+        return sexpr_list();
+    }
+
+    sexpr vectorpfn(const sexpr& x) {
+        if (get<vector_ptr>(&x))
+            return atom(symbol(SymT));
+        return sexpr_list();
+    }
+
+    // (write-binary "file" x) saves x to file in the encoding of
+    // serial.hpp, which (read-binary "file") reads back
+    sexpr write_binaryfn(const sexpr& file, const sexpr& x) {
+        const string& fname = get<string>(get<atom>(file));
+        ofstream f(fname.c_str(), ios::binary | ios::trunc);
+        if (!f.is_open())
+            throw runtime_error("can't write " + fname);
+        write_binary(f, x);
+        f.close();
+        if (!f)
+            throw runtime_error("can't write " + fname);
+        return x;
+    }
+
+    sexpr read_binaryfn(const sexpr& file) {
+        const string& fname = get<string>(get<atom>(file));
+        ifstream f(fname.c_str(), ios::binary);
+        if (!f.is_open())
+            throw runtime_error("file not found");
+        return read_binary(f);
+    }
+
+    // (profile thunk ["file"]) calls thunk under the sampling
+    // profiler, writes the folded stacks to file and a table of the
+    // hot procedures to stdout, and returns what thunk returned
+    sexpr profilefn(sexpr_span args) {
+        if (args.size() < 1 || args.size() > 2)
+            throw runtime_error("profile: expected a procedure and maybe a file");
+        const string fname = args.size() > 1 ? get<string>(get<atom>(args[1])) : "profile.folded";
+        sexprs none;
+        sexpr result;
+        profile_start();
+        try {
+            result = apply(args[0], none);
+        }
+        catch (...) {
+            profile_stop();
+            throw;
+        }
+        profile_stop();
+        ofstream f(fname.c_str(), ios::trunc);
+        if (!f.is_open())
+            throw runtime_error("can't write " + fname);
+        profile_write_folded(f);
+        profile_write_table(cout);
+        return result;
+    }
+
     sexpr loadfn(const sexpr& arg) {
         string fname = get<string>(get<atom>(arg));
-        ifstream f(fname.c_str());
+        source_file f(fname);
         if (!f.is_open())
             throw runtime_error("file not found");
-        repl(f, false, false);
-        return sexprs();
+        const string_ref text(f.data(), f.size());
+        const source_key key = key_of(fname, text);
+        if (!interpreter::current->_use_load_cache || !load_cached(fname, key))
+            load_source(fname, text, key);
+        return sexpr_list();
     }
 
-    sexpr cosfn(const sexpr& v) { return atom(cos(get<double>(get<atom>(v)))); }
-    sexpr sinfn(const sexpr& v) { return atom(sin(get<double>(get<atom>(v)))); }
-    sexpr tanfn(const sexpr& v) { return atom(tan(get<double>(get<atom>(v)))); }
-    sexpr acosfn(const sexpr& v) { return atom(acos(get<double>(get<atom>(v)))); }
-    sexpr asinfn(const sexpr& v) { return atom(asin(get<double>(get<atom>(v)))); }
-    sexpr atanfn(const sexpr& v) { return atom(atan(get<double>(get<atom>(v)))); }
+    sexpr cosfn(const sexpr& v) { return atom(cos(to_double(get<atom>(v)))); }
+    sexpr sinfn(const sexpr& v) { return atom(sin(to_double(get<atom>(v)))); }
+    sexpr tanfn(const sexpr& v) { return atom(tan(to_double(get<atom>(v)))); }
+    sexpr acosfn(const sexpr& v) { return atom(acos(to_double(get<atom>(v)))); }
+    sexpr asinfn(const sexpr& v) { return atom(asin(to_double(get<atom>(v)))); }
+    sexpr atanfn(const sexpr& v) { return atom(atan(to_double(get<atom>(v)))); }
 
     bool is_list_of_len(const sexpr& x, size_t len) {
-        auto l = get<sexprs>(&x);
+        auto l = get<sexpr_list>(&x);
         return l && l->size() == len;
     }
 
@@ -780,105 +1619,117 @@ namespace {
         return (i%2) == 0;
     }
 
-    sexpr letfn(const sexprs& args) {
-        sexprs x = make_list(symbol("let"));
-        x.insert(x.end(), args.begin(), args.end());
+    sexpr letfn(sexpr_span args) {
+        sexpr_list x(atom(symbol("let")), sexpr_list(args.begin(), args.end()));
         REQUIRE(x, args.size() > 1);
         auto& bindings = args[0];
-        auto body = cdr(args);
+        sexpr_list body(args.begin()+1, args.end());
         REQUIRE2(x, is_pair(bindings), "illegal binding list");
-        auto& bindingslist = get<sexprs>(bindings);
+        auto& bindingslist = get<sexpr_list>(bindings);
         REQUIRE2(x, is_even(bindingslist.size()), "illegal binding list");
         sexprs vars;
         sexprs vals;
-        for (size_t i = 0; i < bindingslist.size(); i += 2) {
-            REQUIRE2(x, is_symbol(bindingslist[i]), "illegal binding list");
-            vars.push_back(bindingslist[i]);
-            vals.push_back(bindingslist[i+1]);
-        }
-        sexprs builtin = make_list(symbol("fn"), vars);
-        sexprs builtin_body = map_expand(body);
-        builtin.insert(builtin.end(), builtin_body.begin(), builtin_body.end());
-        sexprs call;
-        call.push_back(builtin);
-        sexprs call_body = map_expand(vals);
-        call.insert(call.end(), call_body.begin(), call_body.end());
-        return call;
-    }
-
-    struct call_continuation : public std::exception {
-        explicit call_continuation(int depth, const sexpr& exp)
-            : std::exception(), _depth(depth), _exp(exp) {
-        }
-        virtual ~call_continuation() {}
-        int _depth;
-        sexpr _exp;
-    };
-
-    sexpr throwfn(int depth, const sexprs& args) {
-        throw call_continuation(depth, args.front());
-    }
-
-    sexpr callccfn(const sexprs& args) {
-        // arg[0] is procedure
-        // call proc with current continuation
-        // (escape only)
-        static int depth = 0;
-        int mydepth = ++depth;
-        try {
-            auto proc = get<procedure_ptr>(args[0]);
-            envptr env(new environment(proc->_vars,
-                                       make_list(make_builtin_va(bind(throwfn, depth, _1))),
-                                       proc->_parent));
-            return eval(proc->_exp, env);
-        }
-        catch (call_continuation& cc) {
-            if (cc._depth < mydepth)
-                throw;
-            depth = 0;
-            return cc._exp;
+        for (auto i = bindingslist.begin(); i != bindingslist.end(); ++i) {
+            REQUIRE2(x, is_symbol(*i), "illegal binding list");
+            vars.push_back(*i++);
+            vals.push_back(*i);
         }
+        sexpr_list fn(atom(symbol(SymFn)), sexpr_list(sexpr_list(vars), map_expand(body)));
+        return sexpr_list(fn, map_expand(sexpr_list(vals)));
     }
 
 }
 
+primitive primitive_of(const sexpr& fn) {
+    auto l = get<builtin>(&fn);
+    if (!l)
+        return PrimNone;
+    if (l->_arity == builtin::Variadic) {
+        if (l->_fn.va == addfn) return PrimAdd;
+        if (l->_fn.va == subfn) return PrimSub;
+        if (l->_fn.va == mulfn) return PrimMul;
+        if (l->_fn.va == divfn) return PrimDiv;
+    }
+    else if (l->_arity == 2) {
+        if (l->_fn.f2 == ltfn) return PrimLt;
+        if (l->_fn.f2 == gtfn) return PrimGt;
+    }
+    return PrimNone;
+}
+
+bool is_pure(const sexpr& fn) {
+    auto l = get<builtin>(&fn);
+    if (!l)
+        return false;
+    switch (l->_arity) {
+    case builtin::Variadic: {
+        static const builtin::variadic pure[] = { addfn, subfn, mulfn, divfn, listfn, consfn, appendfn };
+        return find(begin(pure), end(pure), l->_fn.va) != end(pure);
+    }
+    case 1: {
+        static const builtin::fixed1 pure[] = { notfn, lenfn, carfn, cdrfn, listpfn, nullpfn, symbolpfn,
+                                                sinfn, cosfn, tanfn, acosfn, asinfn, atanfn };
+        return find(begin(pure), end(pure), l->_fn.f1) != end(pure);
+    }
+    case 2: {
+        static const builtin::fixed2 pure[] = { ltfn, gtfn, lteqfn, gteqfn, eqfn, neqfn };
+        return find(begin(pure), end(pure), l->_fn.f2) != end(pure);
+    }
+    }
+    return false;
+}
+
+
 
+namespace {
+    thread_local int repl_depth = 0; // load() runs a nested repl
+}
 
 void repl(istream& in, bool prompt, bool out) {
     token_stream tokens(in);
+    ++repl_depth;
     while (true) {
-        if (in.eof())
+        if (tokens.at_end())
             break;
+        // between top level forms nothing but the globals is live
+        if (repl_depth == 1)
+            gc_safepoint();
         if (prompt)
             cout << ">>> " << flush;
-        try {
-            sexpr exp = eval(parse(tokens), global_env);
-            global_env->add("_", exp);
-            if (out)
-                cout << to_str(exp) << endl;
-        }
-        catch (bad_get& e) {
-            cerr << "type mismatch: " << diagnostic_information(e) << endl;
-        }
-        catch (boost::exception& e) {
-            cerr << "error: " << diagnostic_information(e) << endl;
-        }
-        catch (std::exception& e) {
-            cerr << "error: " << e.what() << endl;
-        }
+        run_toplevel([&] { return parse(tokens); }, out);
     }
+    --repl_depth;
 }
 
-int main(int argc, char* argv[]) {
-    macro_table[symbol("let")] = make_builtin_va(letfn);
-
-    global_env = envptr(new environment);
-
-    global_env->
-         add("+", make_builtin_va(addfn))
-        .add("-", make_builtin_va(subfn))
-        .add("*", make_builtin_va(mulfn))
-        .add("/", make_builtin_va(divfn))
+#ifdef SCHEME_CELLGC
+namespace {
+    int interpreters = 0;
+}
+#endif
+
+interpreter::interpreter()
+    : _engine(TreeWalker),
+      _jit_threshold(0),
+      _optimizing(false),
+      _use_load_cache(true),
+      _max_depth(0),
+      _deepest(0),
+      _frames(16 << 20),
+      _args(1 << 16),
+      _globals(new environment),
+      _macro_definitions(0) {
+#ifdef SCHEME_CELLGC
+    if (interpreters > 0)
+        throw runtime_error("one interpreter at a time with SCHEME_CELLGC");
+    ++interpreters;
+#endif
+    _macros[symbol("let")] = make_builtin(letfn);
+
+    _globals->
+         add("+", make_builtin(addfn))
+        .add("-", make_builtin(subfn))
+        .add("*", make_builtin(mulfn))
+        .add("/", make_builtin(divfn))
         .add("not", make_builtin(notfn))
         .add("<", make_builtin(ltfn))
         .add(">", make_builtin(gtfn))
@@ -887,29 +1738,138 @@ int main(int argc, char* argv[]) {
         .add("==", make_builtin(eqfn))
         .add("!=", make_builtin(neqfn))
         .add("len", make_builtin(lenfn))
-        .add("cons", make_builtin_va(consfn))
+        .add("cons", make_builtin(consfn))
         .add("car", make_builtin(carfn))
         .add("cdr", make_builtin(cdrfn))
-        .add("append", make_builtin_va(appendfn))
-        .add("list", make_builtin_va(listfn))
+        .add("append", make_builtin(appendfn))
+        .add("string-append", make_builtin(string_appendfn))
+        .add("list", make_builtin(listfn))
         .add("list?", make_builtin(listpfn))
         .add("null?", make_builtin(nullpfn))
         .add("symbol?", make_builtin(symbolpfn))
         .add("defvar", make_builtin(defvarfn))
         .add("print-globals", make_builtin(envfn))
-        .add("pr", make_builtin_va(prfn))
+        .add("recursion-depth", make_builtin(deepestfn))
+        .add("pr", make_builtin(prfn))
         .add("load", make_builtin(loadfn))
+        .add("read-file", make_builtin(read_filefn))
+        .add("table", make_builtin(tablefn))
+        .add("vector", make_builtin(vectorfn))
+        .add("get", make_builtin(getfn))
+        .add("set", make_builtin(setfn))
+        .add("has?", make_builtin(haspfn))
+        .add("size", make_builtin(sizefn))
+        .add("keys", make_builtin(keysfn))
+        .add("table?", make_builtin(tablepfn))
+        .add("vector?", make_builtin(vectorpfn))
+        .add("f64vector", make_builtin(f64vectorfn))
+        .add("make-f64vector", make_builtin(make_f64vectorfn))
+        .add("f64vector?", make_builtin(f64vectorpfn))
+        .add("v+", make_builtin(f64vector_op<f64_add>))
+        .add("v-", make_builtin(f64vector_op<f64_sub>))
+        .add("v*", make_builtin(f64vector_op<f64_mul>))
+        .add("v/", make_builtin(f64vector_op<f64_div>))
+        .add("vscale", make_builtin(vscalefn))
+        .add("dot", make_builtin(dotfn))
+        .add("vsum", make_builtin(vsumfn))
+        .add("vmin", make_builtin(f64vector_fold<f64_min>))
+        .add("vmax", make_builtin(f64vector_fold<f64_max>))
+        .add("vmap", make_builtin(vmapfn))
+        .add("write-binary", make_builtin(write_binaryfn))
+        .add("read-binary", make_builtin(read_binaryfn))
+        .add("profile", make_builtin(profilefn))
+        .add("eval-stats", make_builtin(eval_statsfn))
         .add("sin", make_builtin(sinfn))
         .add("cos", make_builtin(cosfn))
         .add("tan", make_builtin(tanfn))
         .add("acos", make_builtin(acosfn))
         .add("asin", make_builtin(asinfn))
         .add("atan", make_builtin(atanfn))
-        .add("call/cc", make_builtin_va(callccfn))
+        .add("call/cc", make_builtin(callcc))
         ;
-    if (argc > 1) {
-        istringstream s(argv[1]);
+}
+
+interpreter::~interpreter() {
+    // letting go of the values may free frames, which needs the
+    // stacks of this interpreter
+    scope running(*this);
+#ifdef SCHEME_CELLGC
+    for (auto& m : _macros)
+        gc_rmroot(&m.second);
+    --interpreters;
+#endif
+    _macros.clear();
+    _inlinables.clear();
+    _globals = envptr();
+}
+
+sexpr interpreter::evaluate(const string& text) {
+    scope running(*this);
+    token_stream tokens(text.data(), text.data() + text.size());
+    sexpr value = sexpr_list();
+    for (token_stream::Token t; (t = tokens.next()) != token_stream::Eof; )
+        value = exec(compile_toplevel(expand(read_ahead(tokens, t), true)));
+    return value;
+}
+
+void interpreter::run(istream& src, bool print) {
+    scope running(*this);
+    repl(src, false, print);
+}
+
+int main(int argc, char* argv[]) {
+    // nothing uses stdio, so cin and cout can buffer on their own
+    // and the lexer can take input a block at a time
+    ios::sync_with_stdio(false);
+
+    interpreter in;
+    interpreter::scope running(in);
+    string profile_file; // --profile, for the whole run
+
+    int arg = 1;
+    for (; arg < argc && string(argv[arg]).compare(0, 2, "--") == 0; ++arg) {
+        string opt(argv[arg]);
+        if (opt == "--engine=eval")
+            in._engine = TreeWalker;
+        else if (opt == "--engine=vm")
+            in._engine = Bytecode;
+        else if (opt == "--jit") {
+            in._engine = Bytecode;
+            in._jit_threshold = 100;
+        }
+        else if (opt.compare(0, 6, "--jit=") == 0) {
+            in._engine = Bytecode;
+            in._jit_threshold = atoi(opt.c_str() + 6);
+        }
+        else if (opt == "--optimize")
+            in._optimizing = true;
+        else if (opt == "--no-load-cache")
+            in._use_load_cache = false;
+        else if (opt.compare(0, 12, "--max-depth=") == 0) {
+            in._max_depth = strtoul(opt.c_str() + 12, nullptr, 10);
+        }
+        else if (opt.compare(0, 10, "--profile=") == 0)
+            profile_file = opt.substr(10);
+        else {
+            cerr << "usage: " << argv[0] << " [--engine=eval|vm] [--jit[=calls]] [--optimize] [--no-load-cache] [--max-depth=frames] [--profile=file] [expr]" << endl;
+            return 1;
+        }
+    }
+    if (!profile_file.empty())
+        profile_start();
+    if (arg < argc) {
+        istringstream s(argv[arg]);
         repl(s, false, false);
     }
     repl(cin, true, true);
+    if (!profile_file.empty()) {
+        profile_stop();
+        ofstream f(profile_file.c_str(), ios::trunc);
+        if (!f.is_open()) {
+            cerr << "can't write " << profile_file << endl;
+            return 1;
+        }
+        profile_write_folded(f);
+        profile_write_table(cerr);
+    }
 }
@@ -0,0 +1,449 @@
+#pragma once
+
+// core data types of the scheme interpreter, shared between
+// the tree-walking eval() in scheme.cpp and the bytecode vm
+
+#include <boost/variant.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <new>
+#include <stdint.h>
+#include "intrusive_ptr.hpp"
+#include "list.hpp"
+#include "span.hpp"
+#include "symbol.hpp"
+#include "stats.hpp"
+
+class procedure;
+struct bytecode;
+struct table;         // see table.hpp
+struct sexpr_vector;
+struct f64vector;     // see f64vector.hpp
+
+// a variable reference resolved by resolve(): slot index in the
+// frame depth levels up from the current environment
+struct localref {
+    localref(unsigned depth, unsigned index, const symbol& name)
+        : _depth(depth), _index(index), _name(name) {
+    }
+    unsigned _depth;
+    unsigned _index;
+    symbol _name;
+};
+
+struct global_cell;
+
+// a variable reference that resolve() found no local binding for,
+// bound to the cell of the name in global_env
+struct globalref {
+    globalref(const symbol& name, global_cell* cell) : _name(name), _cell(cell) {
+    }
+    symbol _name;
+    global_cell* _cell;
+};
+
+// a function implemented in C++. fixed arity functions are called
+// with their arguments directly, the others get a span over them.
+// a bound function also gets the data it was made with
+template <typename T>
+struct basic_builtin {
+    typedef util::span<T> args;
+    typedef T (*fixed0)();
+    typedef T (*fixed1)(const T&);
+    typedef T (*fixed2)(const T&, const T&);
+    typedef T (*fixed3)(const T&, const T&, const T&);
+    typedef T (*variadic)(args);
+    typedef T (*bound)(const void*, args);
+
+    enum { Variadic = -1, Bound = -2 };
+
+    explicit basic_builtin(fixed0 fn) : _arity(0) { _fn.f0 = fn; }
+    explicit basic_builtin(fixed1 fn) : _arity(1) { _fn.f1 = fn; }
+    explicit basic_builtin(fixed2 fn) : _arity(2) { _fn.f2 = fn; }
+    explicit basic_builtin(fixed3 fn) : _arity(3) { _fn.f3 = fn; }
+    explicit basic_builtin(variadic fn) : _arity(Variadic) { _fn.va = fn; }
+    basic_builtin(bound fn, const boost::shared_ptr<const void>& data)
+        : _arity(Bound), _data(data) {
+        _fn.bf = fn;
+    }
+
+    T operator()(args a) const {
+        STAT(builtin_calls);
+        if (_arity >= 0 && a.size() != (size_t)_arity)
+            throw std::runtime_error("bad arity");
+        switch (_arity) {
+        case 0: return _fn.f0();
+        case 1: return _fn.f1(a[0]);
+        case 2: return _fn.f2(a[0], a[1]);
+        case 3: return _fn.f3(a[0], a[1], a[2]);
+        case Variadic: return _fn.va(a);
+        default: return _fn.bf(_data.get(), a);
+        }
+    }
+
+    int _arity;
+    union {
+        fixed0 f0;
+        fixed1 f1;
+        fixed2 f2;
+        fixed3 f3;
+        variadic va;
+        bound bf;
+    } _fn;
+    boost::shared_ptr<const void> _data;
+};
+
+// numbers are exact fixnums or doubles, arithmetic on a mix of
+// the two promotes to double
+typedef int64_t fixnum;
+typedef boost::variant<double, std::string, symbol, fixnum> atom;
+typedef boost::shared_ptr<procedure> procedure_ptr;
+typedef boost::shared_ptr<bytecode> bytecode_ptr;
+typedef boost::shared_ptr<table> table_ptr;
+typedef boost::shared_ptr<sexpr_vector> vector_ptr;
+typedef boost::shared_ptr<f64vector> f64vector_ptr;
+typedef boost::make_recursive_variant<atom,
+                                      util::list<boost::recursive_variant_>,
+                                      procedure_ptr,
+                                      basic_builtin<boost::recursive_variant_>,
+                                      localref,
+                                      globalref,
+                                      table_ptr,
+                                      vector_ptr,
+                                      f64vector_ptr>::type sexpr;
+typedef util::list<sexpr> sexpr_list; // list values and code
+typedef std::vector<sexpr> sexprs;     // argument vectors and scratch space
+typedef util::span<sexpr> sexpr_span;  // arguments of builtins
+typedef basic_builtin<sexpr> builtin;
+
+std::string to_str(const sexpr& l);
+std::string to_str(const atom& a);
+
+// the value of a number as a double, throws bad_get if a isn't one
+inline double to_double(const atom& a) {
+    if (auto i = boost::get<fixnum>(&a))
+        return (double)*i;
+    return boost::get<double>(a);
+}
+
+// position of the symbol x in a list or vector of symbols, or -1
+template <typename Names>
+int index_of(const Names& names, const symbol& x) {
+    int i = 0;
+    for (auto& name : names) {
+        if (*boost::get<symbol>(&boost::get<atom>(name)) == x)
+            return i;
+        ++i;
+    }
+    return -1;
+}
+
+// the binding of a name in the table of an environment. references
+// to globals point straight at the cell, which stays where it is
+// for as long as the environment lives, so rebinding the name with
+// : defvar or = is seen by every reference
+struct global_cell {
+    global_cell() : _value(), _bound(false) {
+    }
+    sexpr _value;
+    bool _bound; // false until defined, for cells made by a reference
+};
+
+struct environment;
+typedef util::intrusive_ptr<environment> envptr;
+
+// called when the last reference to a frame goes away
+void free_frame(environment* e);
+
+// the global environment, or the call frame of a procedure. the
+// slots of a frame are stored right after it in the same block,
+// which is on the frame stack if the procedure never lets its frames
+// be captured (see make_frame), and on the heap otherwise
+struct environment {
+    environment()
+        : _parent(),
+          _names(),
+          _slots(0),
+          _env(),
+          _rc(0),
+          _stacked(false),
+          _below(0),
+          _owner(SymFn) {
+        STAT(environments);
+        add("t", atom(symbol(SymT)));
+        add("f", sexpr_list());
+        add("nil", sexpr_list());
+    }
+
+    environment(const envptr& parent, const sexpr_list& names, sexpr* slots, bool stacked)
+        : _parent(parent),
+          _names(names),
+          _slots(slots),
+          _env(),
+          _rc(0),
+          _stacked(stacked),
+          _below(0),
+          _owner(SymFn) {
+        STAT(environments);
+    }
+
+    environment& add(const char* id, const sexpr& x) {
+        (*this)[symbol(id)] = x;
+        return *this;
+    }
+
+    bool bound(const symbol& x) const {
+        auto i = _env.find(x);
+        return i != _env.end() && i->second._bound;
+    }
+
+    // the cell of x, made unbound if x hasn't been seen before
+    global_cell* cell(const symbol& x) {
+        return &_env[x];
+    }
+
+    int slot_of(const symbol& x) const {
+        return index_of(_names, x);
+    }
+
+    environment& find(const symbol& x) {
+        STAT(find_steps);
+        if (slot_of(x) >= 0 || bound(x))
+            return *this;
+        else if (_parent)
+            return _parent->find(x);
+        else
+            throw std::runtime_error("unknown symbol: " + x.str());
+    }
+
+    environment& find(const sexpr& x) {
+        return find(boost::get<symbol>(boost::get<atom>(x)));
+    }
+
+    sexpr& operator[](const symbol& s) {
+        int i = slot_of(s);
+        if (i >= 0)
+            return _slots[i];
+        global_cell& c = _env[s];
+        c._bound = true;
+        return c._value;
+    }
+
+    sexpr& operator[](const sexpr& x) {
+        return (*this)[boost::get<symbol>(boost::get<atom>(x))];
+    }
+
+    sexpr& operator[](const localref& r) {
+        return slot(r._depth, r._index);
+    }
+
+    sexpr& slot(unsigned depth, unsigned index) {
+        environment* e = this;
+        for (; depth > 0; --depth)
+            e = e->_parent.get();
+        return e->_slots[index];
+    }
+
+    friend void incref(environment* e) {
+        ++e->_rc;
+    }
+
+    friend void decref(environment* e) {
+        if (--e->_rc == 0)
+            free_frame(e);
+    }
+
+    envptr _parent;
+    sexpr_list _names; // slot names, shared with the procedure
+    sexpr* _slots;     // one per name
+    boost::unordered_map<symbol, global_cell> _env; // globals and names defined by unresolved code
+    long _rc;
+    bool _stacked;       // on the frame stack rather than the heap
+    environment* _below; // the frame under this one on the frame stack
+    symbol _owner;       // name of the procedure this is a call frame of
+};
+
+inline
+bool is_variadic(const sexpr_list& vars) {
+    if (vars.size() > 1) {
+        const symbol* sym = boost::get<symbol>(&boost::get<atom>(vars.back()));
+        return sym && sym->id() == SymEllipsis;
+    }
+    return false;
+}
+
+struct procedure {
+    // names are the slots of a call frame as laid out by resolve(),
+    // empty for unresolved code where they are just the arguments.
+    // escapes is false if resolve() found that nothing in the body
+    // can capture the frame. name is what def or : bound it to, fn
+    // for anonymous ones
+    procedure(const sexpr_list& vars, const sexpr& exp, const envptr& parent,
+              const sexpr_list& names = sexpr_list(), bool escapes = true,
+              const symbol& name = symbol(SymFn))
+        : _nargs(vars.size()), _names(names), _exp(exp), _parent(parent),
+          _variadic(is_variadic(vars)), _escapes(escapes), _name(name) {
+        if (_variadic)
+            --_nargs;
+        if (_names.empty() && _nargs > 0) {
+            auto end = vars.begin();
+            std::advance(end, _nargs);
+            _names = sexpr_list(sexprs(vars.begin(), end));
+        }
+    }
+    size_t _nargs; // including the rest argument of a variadic procedure
+    sexpr_list _names; // arguments followed by locals
+    sexpr _exp;
+    envptr _parent;
+    bool _variadic;
+    bool _escapes; // frames may outlive the call
+    symbol _name;
+    bytecode_ptr _code; // compiled body, filled in by the vm
+};
+
+// a call frame for proc holding the n arguments, which are moved
+// from. frames of procedures that don't escape go on the frame stack
+envptr make_frame(const procedure& proc, sexpr* args, size_t n);
+
+// the reserved symbol at the head of the form v, or -1
+inline
+int form_of(const sexpr_list& v) {
+    if (auto a = boost::get<atom>(&v.front()))
+        if (auto sym = boost::get<symbol>(a))
+            if (sym->id() < NumReservedSymbols)
+                return sym->id();
+    return -1;
+}
+
+// the name resolve() gave the fn form v, fn if it has none
+inline
+symbol fn_name(const sexpr_list& v) {
+    if (v.size() > 5)
+        return boost::get<symbol>(boost::get<atom>(v[5]));
+    return symbol(SymFn);
+}
+
+inline
+bool is_call_to(const sexpr_list& v, reserved_symbol s) {
+    return form_of(v) == s;
+}
+
+inline
+bool truth(const sexpr& x) {
+    const sexpr_list* v = boost::get<sexpr_list>(&x);
+    return !(v && v->empty());
+}
+
+// the global environment of the current interpreter
+envptr global_env();
+
+// the value a global reference is bound to
+inline
+sexpr& global_value(const globalref& r) {
+    if (!r._cell->_bound)
+        throw std::runtime_error("unknown symbol: " + r._name.str());
+    return r._cell->_value;
+}
+
+sexpr eval(sexpr x, envptr env = global_env());
+
+// evaluate resolved code with the engine picked on the command line
+sexpr exec(const sexpr& x, const envptr& env = global_env());
+
+// call a procedure or builtin with already evaluated arguments
+sexpr apply(const sexpr& fn, sexprs& args);
+
+// eval evaluates the arguments of calls onto this stack, which is
+// reused from call to call. its storage never moves, so a
+// span over a frame stays valid while the builtin runs and makes
+// calls of its own
+class arg_stack {
+public:
+    explicit arg_stack(size_t capacity)
+        : _base((sexpr*)::operator new(capacity * sizeof(sexpr))),
+          _top(_base), _end(_base + capacity) {
+    }
+    ~arg_stack() {
+        pop_to(_base);
+        ::operator delete(_base);
+    }
+
+    bool room(size_t n) const { return (size_t)(_end - _top) >= n; }
+    sexpr* top() const { return _top; }
+
+    void push(sexpr&& x) {
+        new (_top) sexpr(std::move(x));
+        ++_top;
+    }
+    void pop_to(sexpr* p) {
+        while (_top != p)
+            (--_top)->~sexpr();
+    }
+
+private:
+    arg_stack(const arg_stack&);
+    arg_stack& operator=(const arg_stack&);
+
+    sexpr* _base;
+    sexpr* _top;
+    sexpr* _end;
+};
+
+// the one of the current interpreter
+arg_stack& builtin_args();
+
+// the n arguments of one call, popped when it goes out of scope. a frame that doesn't fit on the stack goes on the heap
+class arg_frame {
+public:
+    explicit arg_frame(size_t n, arg_stack& s = builtin_args())
+        : _stack(s), _base(s.top()), _inline(s.room(n)) {
+        if (!_inline)
+            _heap.reserve(n);
+    }
+    ~arg_frame() {
+        if (_inline)
+            _stack.pop_to(_base);
+    }
+
+    void push(sexpr&& x) {
+        if (_inline)
+            _stack.push(std::move(x));
+        else
+            _heap.push_back(std::move(x));
+    }
+
+    sexpr_span args() const {
+        if (_inline)
+            return sexpr_span(_base, _stack.top() - _base);
+        return _heap;
+    }
+
+    // for handing the arguments over to make_frame
+    sexpr* data() { return _inline ? _base : _heap.data(); }
+    size_t size() const { return args().size(); }
+
+private:
+    arg_frame(const arg_frame&);
+    arg_frame& operator=(const arg_frame&);
+
+    arg_stack& _stack;
+    sexpr* _base;
+    bool _inline;
+    sexprs _heap;
+};
+
+// the numeric builtins that the jit can inline
+enum primitive { PrimNone, PrimAdd, PrimSub, PrimMul, PrimDiv, PrimLt, PrimGt };
+
+// which of the above fn is, if any
+primitive primitive_of(const sexpr& fn);
+
+// true if fn is a builtin without side effects, whose calls
+// on constants can be made ahead of time
+bool is_pure(const sexpr& fn);
+
+// append the names defined with : in the fn body x to names
+void collect_locals(const sexpr& x, sexprs& names);
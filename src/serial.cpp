@@ -0,0 +1,263 @@
+#include "serial.hpp"
+#include "table.hpp"
+#include "f64vector.hpp"
+#include <sstream>
+#include <string.h>
+
+using namespace std;
+using namespace boost;
+
+namespace {
+    enum tag {
+        TagList,      // varint length, then the elements
+        TagFixnum,    // zigzag varint
+        TagDouble,    // 8 bytes, little endian
+        TagString,    // varint length, then the bytes
+        TagSymbol,    // varint number of a symbol seen before
+        TagNewSymbol, // as TagString, numbered in order of appearance
+        TagTable,     // varint size, then keys and values in turn
+        TagVector,    // as TagList
+        TagF64Vector, // varint size, then as many raw doubles
+    };
+
+    uint64_t zigzag(fixnum i) {
+        return ((uint64_t)i << 1) ^ (uint64_t)(i >> 63);
+    }
+
+    fixnum unzigzag(uint64_t n) {
+        return (fixnum)(n >> 1) ^ -(fixnum)(n & 1);
+    }
+
+    const char Magic[] = "k11b\1";
+
+    struct atom_writer : public static_visitor<> {
+        atom_writer(sexpr_writer& w, unordered_map<symbol, uint64_t>& symbols)
+            : _w(w), _symbols(symbols) {
+        }
+
+        void operator()(fixnum i) const {
+            _w.put(TagFixnum);
+            _w.write_varint(zigzag(i));
+        }
+
+        void operator()(double d) const {
+            _w.put(TagDouble);
+            _w.write_double(d);
+        }
+
+        void operator()(const string& s) const {
+            _w.put(TagString);
+            write_bytes(s);
+        }
+
+        void operator()(const symbol& s) const {
+            auto i = _symbols.find(s);
+            if (i != _symbols.end()) {
+                _w.put(TagSymbol);
+                _w.write_varint(i->second);
+                return;
+            }
+            const uint64_t n = _symbols.size();
+            _symbols[s] = n;
+            _w.put(TagNewSymbol);
+            write_bytes(s.str());
+        }
+
+        void write_bytes(const string& s) const {
+            _w.write_varint(s.size());
+            _w.put(s.data(), s.size());
+        }
+
+        sexpr_writer& _w;
+        unordered_map<symbol, uint64_t>& _symbols;
+    };
+}
+
+sexpr_writer::sexpr_writer(ostream& out) : _out(*out.rdbuf()) {
+}
+
+void sexpr_writer::write(const sexpr& x) {
+    if (auto a = get<atom>(&x)) {
+        write_atom(*a);
+    }
+    else if (auto l = get<sexpr_list>(&x)) {
+        put(TagList);
+        write_varint(l->size());
+        for (auto& e : *l)
+            write(e);
+    }
+    else if (auto t = get<table_ptr>(&x)) {
+        put(TagTable);
+        write_varint((*t)->size());
+        (*t)->each([this](const atom& k, const sexpr& v) {
+            write_atom(k);
+            write(v);
+        });
+    }
+    else if (auto v = get<vector_ptr>(&x)) {
+        put(TagVector);
+        write_varint((*v)->_items.size());
+        for (auto& e : (*v)->_items)
+            write(e);
+    }
+    else if (auto v = get<f64vector_ptr>(&x)) {
+        put(TagF64Vector);
+        write_varint((*v)->_data.size());
+        for (double d : (*v)->_data)
+            write_double(d);
+    }
+    else {
+        throw serial_error("can't serialize " + to_str(x));
+    }
+}
+
+void sexpr_writer::write_atom(const atom& a) {
+    apply_visitor(atom_writer(*this, _symbols), a);
+}
+
+void sexpr_writer::put(char ch) {
+    if (_out.sputc(ch) == streambuf::traits_type::eof())
+        throw serial_error("write failed");
+}
+
+void sexpr_writer::put(const char* bytes, size_t n) {
+    if ((size_t)_out.sputn(bytes, n) != n)
+        throw serial_error("write failed");
+}
+
+void sexpr_writer::write_double(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof bits);
+    char bytes[8];
+    for (int i = 0; i < 8; ++i)
+        bytes[i] = (char)(bits >> (8*i));
+    put(bytes, 8);
+}
+
+void sexpr_writer::write_varint(uint64_t n) {
+    char bytes[10];
+    int i = 0;
+    for (; n >= 0x80; n >>= 7)
+        bytes[i++] = (char)(n | 0x80);
+    bytes[i++] = (char)n;
+    put(bytes, i);
+}
+
+sexpr_reader::sexpr_reader(istream& in) : _in(*in.rdbuf()) {
+}
+
+int sexpr_reader::get() {
+    const int ch = _in.sbumpc();
+    if (ch == streambuf::traits_type::eof())
+        throw serial_error("truncated data");
+    return ch;
+}
+
+uint64_t sexpr_reader::read_varint() {
+    uint64_t n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const int ch = get();
+        n |= (uint64_t)(ch & 0x7f) << shift;
+        if (!(ch & 0x80))
+            return n;
+    }
+    throw serial_error("bad varint");
+}
+
+double sexpr_reader::read_double() {
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; ++i)
+        bits |= (uint64_t)get() << (8*i);
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    return d;
+}
+
+string sexpr_reader::read_bytes() {
+    const uint64_t n = read_varint();
+    string s;
+    // grow as the bytes arrive rather than trusting n up front
+    char buf[4096];
+    for (uint64_t left = n; left > 0; ) {
+        const size_t chunk = left < sizeof buf ? left : sizeof buf;
+        if ((size_t)_in.sgetn(buf, chunk) != chunk)
+            throw serial_error("truncated data");
+        s.append(buf, chunk);
+        left -= chunk;
+    }
+    return s;
+}
+
+sexpr sexpr_reader::read() {
+    switch (get()) {
+    case TagList: {
+        const uint64_t n = read_varint();
+        sexprs v;
+        for (uint64_t i = 0; i < n; ++i)
+            v.push_back(read());
+        return sexpr_list(v);
+    }
+    case TagTable: {
+        table_ptr t(new table);
+        for (uint64_t n = read_varint(); n > 0; --n) {
+            sexpr k = read();
+            const atom* key = boost::get<atom>(&k);
+            if (!key)
+                throw serial_error("bad table key");
+            t->set(*key, read());
+        }
+        return t;
+    }
+    case TagVector: {
+        vector_ptr v(new sexpr_vector);
+        for (uint64_t n = read_varint(); n > 0; --n)
+            v->_items.push_back(read());
+        return v;
+    }
+    case TagFixnum:
+        return atom(unzigzag(read_varint()));
+    case TagDouble:
+        return atom(read_double());
+    case TagF64Vector: {
+        f64vector_ptr v(new f64vector);
+        for (uint64_t n = read_varint(); n > 0; --n)
+            v->_data.push_back(read_double());
+        return v;
+    }
+    case TagString:
+        return atom(read_bytes());
+    case TagNewSymbol:
+        _symbols.push_back(symbol(read_bytes()));
+        return atom(_symbols.back());
+    case TagSymbol: {
+        const uint64_t i = read_varint();
+        if (i >= _symbols.size())
+            throw serial_error("bad symbol reference");
+        return atom(_symbols[i]);
+    }
+    }
+    throw serial_error("bad tag");
+}
+
+void write_binary(ostream& out, const sexpr& x) {
+    out.write(Magic, sizeof Magic - 1);
+    sexpr_writer(out).write(x);
+}
+
+sexpr read_binary(istream& in) {
+    char magic[sizeof Magic - 1];
+    if (!in.read(magic, sizeof magic) || memcmp(magic, Magic, sizeof magic) != 0)
+        throw serial_error("not binary data");
+    return sexpr_reader(in).read();
+}
+
+string serialize(const sexpr& x) {
+    ostringstream out;
+    write_binary(out, x);
+    return out.str();
+}
+
+sexpr deserialize(const string& data) {
+    istringstream in(data);
+    return read_binary(in);
+}
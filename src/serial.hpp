@@ -0,0 +1,64 @@
+#pragma once
+
+// a compact binary encoding of data, that is lists, atoms, tables
+// and vectors of either kind: one tag byte per value followed by varint lengths
+// and integers, raw doubles, and symbols spelled out on first use
+// in a stream and referred to by number after that. the readers
+// and writers work on the stream buffer directly, a byte at a time
+// without the per call overhead of istream::get. a table or vector
+// that appears twice is written twice, and one that contains
+// itself can't be written
+
+#include "scheme.hpp"
+#include <boost/unordered_map.hpp>
+#include <istream>
+#include <ostream>
+
+struct serial_error : public std::runtime_error {
+    explicit serial_error(const std::string& msg) : std::runtime_error(msg) {}
+};
+
+class sexpr_writer {
+public:
+    explicit sexpr_writer(std::ostream& out);
+
+    // throws serial_error for values that aren't data
+    void write(const sexpr& x);
+    void write_varint(uint64_t n);
+    void write_double(double d);
+
+    // raw bytes
+    void put(char ch);
+    void put(const char* bytes, size_t n);
+
+private:
+    void write_atom(const atom& a);
+
+    std::streambuf& _out;
+    boost::unordered_map<symbol, uint64_t> _symbols;
+};
+
+class sexpr_reader {
+public:
+    explicit sexpr_reader(std::istream& in);
+
+    // throws serial_error if the input is cut short or malformed
+    sexpr read();
+    uint64_t read_varint();
+    double read_double();
+
+private:
+    int get();
+    std::string read_bytes();
+
+    std::streambuf& _in;
+    std::vector<symbol> _symbols;
+};
+
+// a single value with a header saying what it is, as written by
+// write-binary and read by read-binary
+void write_binary(std::ostream& out, const sexpr& x);
+sexpr read_binary(std::istream& in);
+
+std::string serialize(const sexpr& x);
+sexpr deserialize(const std::string& data);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// a view of a contiguous run of elements owned by someone else
+
+namespace util {
+    template <typename T>
+    struct span {
+        typedef T value_type;
+        typedef const T* iterator;
+        typedef const T* const_iterator;
+
+        span() : _begin(0), _size(0) {
+        }
+
+        span(const T* begin, size_t size) : _begin(begin), _size(size) {
+        }
+
+        span(const std::vector<T>& v) : _begin(v.data()), _size(v.size()) {
+        }
+
+        bool empty() const { return _size == 0; }
+        size_t size() const { return _size; }
+
+        const T& operator[](size_t i) const { return _begin[i]; }
+        const T& front() const { return _begin[0]; }
+        const T& back() const { return _begin[_size - 1]; }
+
+        const T* begin() const { return _begin; }
+        const T* end() const { return _begin + _size; }
+
+        span subspan(size_t offset) const {
+            return span(_begin + offset, _size - offset);
+        }
+
+        const T* _begin;
+        size_t _size;
+    };
+}
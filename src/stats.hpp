@@ -0,0 +1,33 @@
+#pragma once
+
+// counts of what the interpreter does, for catching a change that
+// makes a script do much more of something. they are only kept when
+// built with -DSCHEME_STATS, otherwise STAT() compiles to nothing.
+// each thread counts for itself
+
+#include <cstddef>
+
+struct eval_stats {
+    size_t _evals;          // turns of the eval loop
+    size_t _calls;          // procedure calls, in any engine
+    size_t _builtin_calls;
+    size_t _environments;   // call frames and global environments made
+    size_t _find_steps;     // frames walked by environment::find()
+    size_t _allocations;    // list nodes
+    size_t _allocated_bytes;
+    size_t _expansions;     // macro calls made by expand()
+};
+
+#ifdef SCHEME_STATS
+extern thread_local eval_stats stats;
+
+#define STAT(counter) (++stats._##counter)
+#define STAT_ADD(counter, n) (stats._##counter += (n))
+
+// the counts of this thread so far
+eval_stats current_stats();
+void reset_stats();
+#else
+#define STAT(counter) ((void)0)
+#define STAT_ADD(counter, n) ((void)0)
+#endif
@@ -1,4 +1,91 @@
 #include "symbol.hpp"
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <boost/functional/hash.hpp>
 
-symbol::table_type symbol::table;
+namespace {
+    const char* const reserved_names[NumReservedSymbols] = {
+        "quote", "if", "=", ":", "def", "fn", "do", "defmacro",
+        "quasiquote", "unquote", "unquote-splicing", "...", "t"
+    };
 
+    struct name_hash {
+        std::size_t operator()(boost::string_ref s) const {
+            return boost::hash_range(s.begin(), s.end());
+        }
+    };
+
+    // keyed by the names in the table, so looking up a slice of the
+    // input doesn't copy it
+    typedef std::unordered_map<boost::string_ref, unsigned, name_hash> name_map;
+
+    // symbols can be made on any thread. adding one takes a lock, and
+    // names are kept in blocks that never move so str() needn't
+    struct symbol_table {
+        static const unsigned BlockBits = 12;
+        static const unsigned BlockSize = 1 << BlockBits;
+        static const unsigned MaxBlocks = 1 << 14;
+
+        symbol_table() : _count(0) {
+            for (auto& b : _blocks)
+                b.store(nullptr, std::memory_order_relaxed);
+            for (const char* name : reserved_names)
+                add(name);
+        }
+
+        unsigned add(boost::string_ref s) {
+            std::lock_guard<std::mutex> hold(_lock);
+            auto i = _ids.find(s);
+            if (i != _ids.end())
+                return i->second;
+            const unsigned id = _count;
+            std::string* block = _blocks[id >> BlockBits].load(std::memory_order_relaxed);
+            if (!block) {
+                if ((id >> BlockBits) >= MaxBlocks)
+                    throw std::runtime_error("too many symbols");
+                block = new std::string[BlockSize];
+                _blocks[id >> BlockBits].store(block, std::memory_order_release);
+            }
+            std::string& name = block[id & (BlockSize - 1)];
+            name.assign(s.begin(), s.end());
+            _ids.emplace(boost::string_ref(name), id);
+            ++_count;
+            return id;
+        }
+
+        const std::string& name(unsigned id) const {
+            return _blocks[id >> BlockBits].load(std::memory_order_acquire)[id & (BlockSize - 1)];
+        }
+
+        std::atomic<std::string*> _blocks[MaxBlocks];
+        std::mutex _lock;
+        unsigned _count;
+        name_map _ids;
+    };
+
+    // a function static, so symbols can be made during static init
+    symbol_table& table() {
+        static symbol_table t;
+        return t;
+    }
+
+    // the names this thread has looked up, in front of the table so
+    // that threads reading in parallel don't queue on its lock
+    thread_local name_map seen;
+}
+
+unsigned symbol::intern(boost::string_ref s) {
+    auto i = seen.find(s);
+    if (i != seen.end())
+        return i->second;
+    symbol_table& t = table();
+    const unsigned id = t.add(s);
+    seen.emplace(boost::string_ref(t.name(id)), id);
+    return id;
+}
+
+const std::string& symbol::str() const {
+    return table().name(_id);
+}
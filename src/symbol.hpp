@@ -1,28 +1,70 @@
 #pragma once
 
-#include <set>
+#include <boost/utility/string_ref.hpp>
 #include <string>
+#include <cstddef>
 
+// symbols the evaluator dispatches on, interned ahead of everything
+// else so that their ids are constants
+enum reserved_symbol {
+    SymQuote,
+    SymIf,
+    SymSet,       // =
+    SymDefine,    // :
+    SymDef,
+    SymFn,
+    SymDo,
+    SymDefmacro,
+    SymQuasiquote,
+    SymUnquote,
+    SymUnquoteSplicing,
+    SymEllipsis,  // ...
+    SymT,
+    NumReservedSymbols
+};
+
+// an interned string, compared and hashed by its integer id
 struct symbol {
-    typedef std::set<std::string> table_type;
-    static table_type table;
+    explicit symbol(const char* s) : _id(intern(s)) {
+    }
+
+    explicit symbol(const std::string& s) : _id(intern(s)) {
+    }
+
+    explicit symbol(boost::string_ref s) : _id(intern(s)) {
+    }
 
-    explicit symbol(const char* s) {
-        i = table.insert(std::move(std::string(s))).first;
+    explicit symbol(reserved_symbol id) : _id(id) {
     }
 
+    unsigned id() const {
+        return _id;
+    }
+
+    const std::string& str() const;
+
     const char* c_str() const {
-        return i->c_str();
+        return str().c_str();
     }
 
     bool operator==(const symbol& s) const {
-        return i == s.i;
+        return _id == s._id;
     }
 
     bool operator!=(const symbol& s) const {
-        return i != s.i;
+        return _id != s._id;
+    }
+
+    bool operator<(const symbol& s) const {
+        return _id < s._id;
+    }
+
+    friend std::size_t hash_value(const symbol& s) {
+        return s._id;
     }
 
 private:
-    table_type::iterator i;
+    static unsigned intern(boost::string_ref s);
+
+    unsigned _id;
 };
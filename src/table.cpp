@@ -0,0 +1,86 @@
+#include "table.hpp"
+#include <boost/functional/hash.hpp>
+#include <string.h>
+
+using namespace std;
+using namespace boost;
+
+namespace {
+    size_t mix(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdull;
+        x ^= x >> 33;
+        return (size_t)x;
+    }
+
+    // integral doubles hash like the fixnum they equal
+    size_t hash_of(const atom& a) {
+        if (auto i = get<fixnum>(&a))
+            return mix((uint64_t)*i);
+        if (auto d = get<double>(&a)) {
+            if (*d > -9.2e18 && *d < 9.2e18 && *d == (double)(fixnum)*d)
+                return mix((uint64_t)(fixnum)*d);
+            uint64_t bits;
+            memcpy(&bits, d, sizeof bits);
+            return mix(bits);
+        }
+        if (auto s = get<symbol>(&a))
+            return mix(s->id() ^ 0x9e3779b97f4a7c15ull);
+        return hash_value(get<string>(a));
+    }
+
+    bool same_key(const atom& a, const atom& b) {
+        const bool an = get<fixnum>(&a) || get<double>(&a);
+        const bool bn = get<fixnum>(&b) || get<double>(&b);
+        if (!an || !bn)
+            return a == b;
+        if (get<fixnum>(&a) && get<fixnum>(&b))
+            return get<fixnum>(a) == get<fixnum>(b);
+        return to_double(a) == to_double(b);
+    }
+}
+
+size_t table::probe(const atom& key, size_t hash) const {
+    const size_t mask = _slots.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const slot& s = _slots[i];
+        if (!s._used || (s._hash == hash && same_key(s._key, key)))
+            return i;
+    }
+}
+
+const sexpr* table::find(const atom& key) const {
+    if (_slots.empty())
+        return nullptr;
+    const slot& s = _slots[probe(key, hash_of(key))];
+    return s._used ? &s._value : nullptr;
+}
+
+void table::set(const atom& key, const sexpr& value) {
+    // keep at least a quarter of the slots empty
+    if (4*(_size + 1) > 3*_slots.size())
+        grow();
+    const size_t hash = hash_of(key);
+    slot& s = _slots[probe(key, hash)];
+    if (!s._used) {
+        s._key = key;
+        s._hash = hash;
+        s._used = true;
+        ++_size;
+    }
+    s._value = value;
+}
+
+void table::grow() {
+    vector<slot> old(_slots.empty() ? 8 : 2*_slots.size());
+    old.swap(_slots);
+    const size_t mask = _slots.size() - 1;
+    for (auto& s : old) {
+        if (!s._used)
+            continue;
+        size_t i = s._hash & mask;
+        while (_slots[i]._used)
+            i = (i + 1) & mask;
+        _slots[i] = std::move(s);
+    }
+}
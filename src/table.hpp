@@ -0,0 +1,46 @@
+#pragma once
+
+// the hash table and vector types behind {k v ...} and [a b c].
+// the reader turns those into calls to the table and vector
+// builtins, so their elements are evaluated like arguments
+
+#include "scheme.hpp"
+
+// an open addressed hash table keyed by atom, with linear probing.
+// numbers are equal by value as with ==, so 1 and 1.0 are one key
+struct table {
+    table() : _size(0) {}
+
+    size_t size() const { return _size; }
+
+    // the value for key, or null
+    const sexpr* find(const atom& key) const;
+    void set(const atom& key, const sexpr& value);
+
+    template <typename Fn>
+    void each(Fn fn) const {
+        for (auto& s : _slots)
+            if (s._used)
+                fn(s._key, s._value);
+    }
+
+private:
+    struct slot {
+        slot() : _key(), _value(), _hash(0), _used(false) {}
+        atom _key;
+        sexpr _value;
+        size_t _hash;
+        bool _used;
+    };
+
+    // the slot key is in, or the empty one it would go in
+    size_t probe(const atom& key, size_t hash) const;
+    void grow();
+
+    std::vector<slot> _slots; // a power of two of them, or none
+    size_t _size;
+};
+
+struct sexpr_vector {
+    sexprs _items;
+};
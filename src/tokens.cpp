@@ -1,30 +1,147 @@
 #include "tokens.hpp"
-#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-token_stream::token_stream(std::istream& src) : _src(src) {
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+    enum char_class {
+        Space = 1,   // as isspace in the C locale
+        Delim = 2,   // ends a symbol or number
+        Digit = 4,
+    };
+
+    struct class_table {
+        class_table() {
+            memset(_classes, 0, sizeof _classes);
+            for (const char* p = " \t\n\v\f\r"; *p; ++p)
+                _classes[(unsigned char)*p] = Space | Delim;
+            for (const char* p = ")}]"; *p; ++p)
+                _classes[(unsigned char)*p] = Delim;
+            for (int ch = '0'; ch <= '9'; ++ch)
+                _classes[ch] = Digit;
+        }
+
+        unsigned char operator[](char ch) const {
+            return _classes[(unsigned char)ch];
+        }
+
+        unsigned char _classes[256];
+    };
+
+    const class_table classes;
+
+    const size_t BlockSize = 1 << 16;
+
+    // the first character in [p, end) that isn't whitespace
+    const char* skip_blanks(const char* p, const char* end) {
+        if (p == end || !(classes[*p] & Space))
+            return p;
+#if defined(__x86_64__)
+        // sixteen at a time: ' ', or \t to \r
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i below = _mm_set1_epi8('\t' - 1);
+        const __m128i above = _mm_set1_epi8('\r' + 1);
+        for (; end - p >= 16; p += 16) {
+            const __m128i c = _mm_loadu_si128((const __m128i*)p);
+            const __m128i blank = _mm_or_si128(
+                _mm_cmpeq_epi8(c, space),
+                _mm_and_si128(_mm_cmpgt_epi8(c, below), _mm_cmplt_epi8(c, above)));
+            const unsigned others = ~_mm_movemask_epi8(blank) & 0xffff;
+            if (others)
+                return p + __builtin_ctz(others);
+        }
+#endif
+        while (p != end && (classes[*p] & Space))
+            ++p;
+        return p;
+    }
 }
 
-token_stream::Token token_stream::next() {
-    text = "";
+token_stream::token_stream(std::istream& src)
+    : _src(&src), _block(BlockSize), _tok(&_block[0]), _p(_tok), _end(_tok), _eof(false) {
+}
 
-    if (!_src.good())
-        return Eof;
+token_stream::token_stream(const char* begin, const char* end)
+    : _src(nullptr), _tok(begin), _p(begin), _end(end), _eof(false) {
+}
 
-    // eat whitespace and comments
-    int ch = _src.get();
-    while (isspace(ch) || ch == ';') {
-        while (isspace(ch))
-            ch = _src.get();
-        if (ch == ';') {
-            while (ch != '\n' && _src.good())
-                ch = _src.get();
+bool token_stream::fill() {
+    if (!_src) {
+        _eof = true;
+        return false;
+    }
+    const size_t keep = _end - _tok;
+    const size_t at = _p - _tok;
+    if (keep > 0)
+        memmove(&_block[0], _tok, keep);
+    if (_block.size() - keep < BlockSize / 2)
+        _block.resize(_block.size() * 2);
+    char* dst = &_block[keep];
+    const size_t room = _block.size() - keep;
+    size_t got = 0;
+    // wait for one character, then take whatever else has arrived
+    std::streambuf& in = *_src->rdbuf();
+    std::streamsize avail = in.in_avail();
+    if (avail <= 0) {
+        const int ch = in.sbumpc();
+        if (ch == std::streambuf::traits_type::eof()) {
+            _src->setstate(std::ios::eofbit);
+            _eof = true;
+        }
+        else {
+            dst[got++] = (char)ch;
+            avail = in.in_avail();
         }
     }
+    if (avail > 0)
+        got += in.sgetn(dst + got, std::min((size_t)avail, room - got));
+    _tok = &_block[0];
+    _p = _tok + at;
+    _end = _tok + keep + got;
+    return got > 0;
+}
 
-    if (!_src.good())
+void token_stream::skip_space() {
+    while (true) {
+        _p = skip_blanks(_p, _end);
+        if (_p == _end) {
+            _tok = _p;
+            if (!fill())
+                return;
+            continue;
+        }
+        if (*_p != ';')
+            return;
+        while (true) {
+            const void* nl = memchr(_p, '\n', _end - _p);
+            if (nl) {
+                _p = (const char*)nl + 1;
+                break;
+            }
+            _p = _tok = _end;
+            if (!fill())
+                return;
+        }
+    }
+}
+
+token_stream::Token token_stream::next() {
+    text.clear();
+
+    skip_space();
+    if (_p == _end)
         return Eof;
 
-    switch (ch) {
+    _tok = _p;
+    switch (*_p++) {
     case '(': return LParen;
     case ')': return RParen;
     case '{': return LMap;
@@ -34,20 +151,23 @@ token_stream::Token token_stream::next() {
     case '\'': text = "quote"; return Quote;
     case '`': text = "quasiquote"; return Quasiquote;
     case ',': {
-        if (_src.get() == '@') {
+        if ((_p != _end || fill()) && *_p == '@') {
+            ++_p;
             text = "unquote-splicing";
             return UnquoteSplicing;
         }
-        _src.unget();
         text = "unquote";
         return Unquote;
     }
-    case '"': fill_string(); return String;
+    case '"': scan_string(); return String;
     default: {
-        fill_text(ch);
-        const char* b = text.c_str();
-        if (((*b == '-' || *b == '.') && isdigit(*(b+1))) ||
-            isdigit(*b)) {
+        scan_text();
+        // 1, -1, .5 and -.5 start numbers, the reader checks the rest
+        const char* b = text.data();
+        size_t i = b[0] == '-' ? 1 : 0;
+        if (i < text.size() && b[i] == '.')
+            ++i;
+        if (i < text.size() && (classes[b[i]] & Digit)) {
             return Number;
         }
         else {
@@ -57,34 +177,137 @@ token_stream::Token token_stream::next() {
     }
 }
 
-void token_stream::fill_text(int ch) {
-    while (!isspace(ch) && ch != ')' &&
-           ch != '}' &&
-           ch != ']') {
-        text += (char)ch;
-        ch = _src.get();
+void token_stream::scan_text() {
+    while (true) {
+        while (_p != _end && !(classes[*_p] & Delim))
+            ++_p;
+        if (_p != _end || !fill())
+            break;
+    }
+    text = boost::string_ref(_tok, _p - _tok);
+}
+
+void token_stream::scan_string() {
+    // without escapes the text is the slice between the quotes
+    _tok = _p;
+    while (true) {
+        while (_p != _end && *_p != '"' && *_p != '\\')
+            ++_p;
+        if (_p != _end)
+            break;
+        if (!fill())
+            throw token_error("unterminated string");
+    }
+    if (*_p == '"') {
+        text = boost::string_ref(_tok, _p - _tok);
+        ++_p;
+        return;
+    }
+
+    _scratch.assign(_tok, _p);
+    while (true) {
+        if (_p == _end) {
+            _tok = _p;
+            if (!fill())
+                throw token_error("unterminated string");
+        }
+        const char ch = *_p++;
+        if (ch == '"')
+            break;
+        if (ch != '\\') {
+            _scratch += ch;
+            continue;
+        }
+        if (_p == _end) {
+            _tok = _p;
+            if (!fill())
+                throw token_error("unterminated string");
+        }
+        switch (*_p++) {
+        case '\\': _scratch += '\\'; break;
+        case 'n': _scratch += '\n'; break;
+        case 'r': _scratch += '\r'; break;
+        case 't': _scratch += '\t'; break;
+        case '"': _scratch += '"'; break;
+        default: throw token_error("unrecognized escape sequence in string");
+        }
     }
-    _src.unget();
+    text = _scratch;
 }
 
-void token_stream::fill_string() {
-    std::stringstream ss;
-    int ch = _src.get();
-    while (ch != '"') {
-        if (ch == '\\') {
-            switch (_src.get()) {
-            case '\\': ss << '\\'; break;
-            case 'n': ss << '\n'; break;
-            case 'r': ss << '\r'; break;
-            case 't': ss << '\t'; break;
-            case '"': ss << '"'; break;
-            default: throw token_error("unrecognized escape sequence in string");
+std::vector<const char*> split_forms(const char* begin, const char* end, size_t n) {
+    std::vector<const char*> points(1, begin);
+    const size_t step = n > 1 ? (end - begin) / n : end - begin;
+    const char* next = begin + step;
+    size_t depth = 0;
+    const char* p = begin;
+    while (p != end && (size_t)(end - p) > step / 2) {
+        p = skip_blanks(p, end);
+        if (p == end)
+            break;
+        switch (*p++) {
+        case ';': {
+            const void* nl = memchr(p, '\n', end - p);
+            p = nl ? (const char*)nl + 1 : end;
+            break;
+        }
+        case '(': case '{': case '[':
+            ++depth;
+            break;
+        case ')': case '}': case ']':
+            // a stray one is an error for the reader to report
+            if (depth > 0 && --depth == 0 && p >= next) {
+                points.push_back(p);
+                next = p + step;
             }
+            break;
+        case '\'': case '`':
+            break;
+        case ',':
+            if (p != end && *p == '@')
+                ++p;
+            break;
+        case '"':
+            while (p != end && *p != '"')
+                p += *p == '\\' && p + 1 != end ? 2 : 1;
+            if (p != end)
+                ++p;
+            break;
+        default:
+            while (p != end && !(classes[*p] & Delim))
+                ++p;
+            break;
         }
-        else {
-            ss << (char)ch;
+    }
+    points.push_back(end);
+    return points;
+}
+
+source_file::source_file(const std::string& fname)
+    : _open(false), _data(""), _size(0), _map(nullptr) {
+    const int fd = open(fname.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    _open = true;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            _map = p;
+            _data = (const char*)p;
+            _size = st.st_size;
         }
-        ch = _src.get();
     }
-    text = ss.str();
+    close(fd);
+    if (!_map) {
+        std::ifstream f(fname.c_str(), std::ios::binary);
+        _copy.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        _data = _copy.data();
+        _size = _copy.size();
+    }
+}
+
+source_file::~source_file() {
+    if (_map)
+        munmap(_map, _size);
 }
@@ -1,7 +1,14 @@
 #pragma once
 
+// the lexer works over a contiguous buffer, a whole file mapped into
+// memory or a stream read a block at a time. the text of a token is
+// a slice of that buffer, or of scratch space for strings with
+// escapes in them, and is good until the next call to next()
+
+#include <boost/utility/string_ref.hpp>
 #include <istream>
 #include <string>
+#include <vector>
 #include <stdexcept>
 #include <stdlib.h>
 
@@ -26,14 +33,60 @@ struct token_stream {
         Unquote,
         UnquoteSplicing,
     };
+    // reads src a block at a time, or for interactive input as much
+    // as there is
     token_stream(std::istream& src);
+    // the text in [begin, end), which has to outlive the stream
+    token_stream(const char* begin, const char* end);
 
     Token next();
 
-    std::string text;
+    // once a token has run into the end of the input, as eof() on
+    // an istream
+    bool at_end() const { return _eof; }
+
+    boost::string_ref text;
+
+private:
+    // reads more, keeping what's been scanned from _tok on, false
+    // at the end of the input
+    bool fill();
+    void skip_space();
+    void scan_text();
+    void scan_string();
+
+    std::istream* _src;
+    std::vector<char> _block;
+    const char* _tok; // start of the token being scanned
+    const char* _p;
+    const char* _end;
+    std::string _scratch;
+    bool _eof;
+};
+
+// where to cut [begin, end) into about n pieces that read as whole
+// top level forms: just after the bracket that closes one, found by
+// stepping over tokens as the lexer would. the first point is begin
+// and the last end
+std::vector<const char*> split_forms(const char* begin, const char* end, size_t n);
+
+// the contents of a file, mapped into memory if it can be
+class source_file {
+public:
+    explicit source_file(const std::string& fname);
+    ~source_file();
+
+    bool is_open() const { return _open; }
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
 
 private:
-    void fill_text(int ch);
-    void fill_string();
-    std::istream& _src;
+    source_file(const source_file&);
+    void operator=(const source_file&);
+
+    bool _open;
+    const char* _data;
+    size_t _size;
+    void* _map;
+    std::string _copy; // when it can't be mapped
 };
@@ -0,0 +1,424 @@
+#include "vm.hpp"
+#include "jit.hpp"
+#include "profiler.hpp"
+#include "interpreter.hpp"
+#include <iterator>
+#include <algorithm>
+
+using namespace std;
+using namespace boost;
+
+namespace {
+
+    struct compiler {
+        explicit compiler(bytecode& bc) : _bc(bc) {
+        }
+
+        size_t emit(opcode op, uint32_t arg = 0) {
+            if (arg >= (1 << 24))
+                throw runtime_error("vm: code too large");
+            _bc._code.push_back(op | (arg << 8));
+            return _bc._code.size() - 1;
+        }
+
+        void emit_slot(opcode op, unsigned depth, unsigned index) {
+            if (depth >= (1 << 8) || index >= (1 << 16))
+                throw runtime_error("vm: too many nested frames or locals");
+            emit(op, depth | (index << 8));
+        }
+
+        uint32_t constant(const sexpr& x) {
+            _bc._consts.push_back(x);
+            return _bc._consts.size() - 1;
+        }
+
+        void patch(size_t at) {
+            const uint32_t here = _bc._code.size();
+            _bc._code[at] = op_of(_bc._code[at]) | (here << 8);
+        }
+
+        void compile_set(const sexpr& var, bool define) {
+            if (auto r = get<localref>(&var)) {
+                emit_slot(OpSetLocal, r->_depth, r->_index);
+                emit(OpConst, constant(atom(r->_name)));
+            }
+            else if (auto r = get<globalref>(&var)) {
+                emit(OpSetGlobal, constant(*r));
+                emit(OpConst, constant(atom(r->_name)));
+            }
+            else {
+                emit(define ? OpDefName : OpSetName, constant(var));
+                emit(OpConst, constant(var));
+            }
+        }
+
+        // compile x, leaving its value on the stack, or returning
+        // it from the current procedure if tail is set
+        void compile(const sexpr& x, bool tail) {
+            auto v = get<sexpr_list>(&x);
+            if (auto r = get<localref>(&x)) {
+                emit_slot(OpLocal, r->_depth, r->_index);
+            }
+            else if (auto r = get<globalref>(&x)) {
+                emit(OpGlobal, constant(*r));
+            }
+            else if (get<symbol>(get<atom>(&x))) {
+                emit(OpName, constant(x));
+            }
+            else if (!v || v->empty()) {
+                emit(OpConst, constant(x));
+            }
+            else {
+                switch (form_of(*v)) {
+                case SymQuote:
+                    emit(OpConst, constant((*v)[1]));
+                    break;
+                case SymIf: {
+                    compile((*v)[1], false);
+                    size_t jf = emit(OpJumpIfNot);
+                    compile((*v)[2], tail);
+                    size_t j = tail ? 0 : emit(OpJump);
+                    patch(jf);
+                    compile((*v)[3], tail);
+                    if (!tail)
+                        patch(j);
+                    return;
+                }
+                case SymSet:
+                    compile((*v)[2], false);
+                    compile_set((*v)[1], false);
+                    break;
+                case SymDefine:
+                case SymDef:
+                    compile((*v)[2], false);
+                    compile_set((*v)[1], true);
+                    break;
+                case SymFn: {
+                    fntemplate t;
+                    t._vars = get<sexpr_list>((*v)[1]);
+                    t._escapes = true;
+                    if (v->size() > 4) {
+                        t._names = get<sexpr_list>((*v)[3]);
+                        t._escapes = truth((*v)[4]);
+                    }
+                    t._name = fn_name(*v);
+                    t._exp = (*v)[2];
+                    t._code = ::compile(t._exp);
+                    _bc._fns.push_back(t);
+                    emit(OpClosure, _bc._fns.size() - 1);
+                    break;
+                }
+                case SymDo: {
+                    const sexpr_list& body = v->cdr();
+                    if (body.empty()) {
+                        emit(OpConst, constant(sexpr_list()));
+                        break;
+                    }
+                    auto i = body.begin();
+                    for (auto next = i; ++next != body.end(); i = next) {
+                        compile(*i, false);
+                        emit(OpPop);
+                    }
+                    compile(*i, tail);
+                    return;
+                }
+                default:
+                    for (auto& e : *v)
+                        compile(e, false);
+                    emit(tail ? OpTailCall : OpCall, v->size() - 1);
+                    return;
+                }
+            }
+            if (tail)
+                emit(OpReturn);
+        }
+
+        bytecode& _bc;
+    };
+
+    // on this thread
+    thread_local unsigned runs = 0;           // activations of run() so far
+    thread_local vector<unsigned> active_runs; // the ones still running, innermost last
+
+    bool active(unsigned run) {
+        return find(active_runs.begin(), active_runs.end(), run) != active_runs.end();
+    }
+
+    struct activation {
+        activation() : _id(++runs) {
+            active_runs.push_back(_id);
+        }
+        ~activation() {
+            active_runs.pop_back();
+        }
+        unsigned _id;
+    };
+
+    // a continuation invoked from outside the vm loop, on its way
+    // to the run() that can resume it: the one it was captured in
+    // if that's still running, otherwise the innermost one
+    struct resumption : public runtime_error {
+        resumption(const boost::shared_ptr<const continuation>& k, const sexpr& value)
+            : runtime_error("continuation can't be resumed outside the vm"),
+              _k(k), _value(value) {
+        }
+        boost::shared_ptr<const continuation> _k;
+        sexpr _value;
+    };
+
+    sexpr run(bytecode_ptr code, envptr env, const resumption* from = nullptr);
+
+    sexpr resume(const void* data, sexpr_span args) {
+        if (args.size() != 1)
+            throw runtime_error("bad arity");
+        const continuation* k = (const continuation*)data;
+        resumption r(k->shared_from_this(), args[0]);
+        if (active_runs.empty())
+            return run(bytecode_ptr(), envptr(), &r);
+        throw r;
+    }
+
+    bool is_callcc(const builtin& fn) {
+        return fn._arity == builtin::Variadic && fn._fn.va == callcc;
+    }
+
+    // what the profiler sees of a vm loop
+    struct vm_frames {
+        const vector<frame>& _frames;
+        const envptr& _env;
+    };
+
+    void walk_vm(const void* state, vector<const environment*>& out) {
+        const vm_frames& s = *(const vm_frames*)state;
+        for (auto& f : s._frames)
+            out.push_back(f._env.get());
+        out.push_back(s._env.get());
+    }
+
+    sexpr run(bytecode_ptr code, envptr env, const resumption* from) {
+        activation self;
+        sexprs stack;
+        vector<frame> frames;
+        const vm_frames seen = { frames, env };
+        profiled_run profiled(walk_vm, &seen);
+        const uint32_t* pc = nullptr;
+        // carry on from k with value on the stack, false if that
+        // returns from the loop
+        auto restore = [&](const continuation& k, const sexpr& value) {
+            stack = k._stack;
+            frames = k._frames;
+            stack.push_back(value);
+            code = k._resume._code;
+            pc = k._resume._pc;
+            env = k._resume._env;
+            return (bool)code;
+        };
+        if (from) {
+            if (!restore(*from->_k, from->_value))
+                return stack.back();
+        }
+        else {
+            pc = &code->_code[0];
+        }
+
+        while (true) {
+            try {
+                while (true) {
+                    const uint32_t w = *pc++;
+                    switch (op_of(w)) {
+                    case OpConst:
+                        stack.push_back(code->_consts[arg_of(w)]);
+                        break;
+                    case OpLocal:
+                        stack.push_back(env->slot(frame_depth(w), frame_slot(w)));
+                        break;
+                    case OpGlobal:
+                        stack.push_back(global_value(get<globalref>(code->_consts[arg_of(w)])));
+                        break;
+                    case OpName: {
+                        const sexpr& name = code->_consts[arg_of(w)];
+                        stack.push_back(env->find(name)[name]);
+                        break;
+                    }
+                    case OpSetLocal:
+                        env->slot(frame_depth(w), frame_slot(w)) = stack.back();
+                        stack.pop_back();
+                        break;
+                    case OpSetGlobal:
+                        global_value(get<globalref>(code->_consts[arg_of(w)])) = std::move(stack.back());
+                        stack.pop_back();
+                        break;
+                    case OpSetName: {
+                        const sexpr& name = code->_consts[arg_of(w)];
+                        env->find(name)[name] = stack.back();
+                        stack.pop_back();
+                        break;
+                    }
+                    case OpDefName: {
+                        const sexpr& name = code->_consts[arg_of(w)];
+                        (*env)[name] = stack.back();
+                        stack.pop_back();
+                        break;
+                    }
+                    case OpPop:
+                        stack.pop_back();
+                        break;
+                    case OpJump:
+                        pc = &code->_code[arg_of(w)];
+                        break;
+                    case OpJumpIfNot: {
+                        const bool t = truth(stack.back());
+                        stack.pop_back();
+                        if (!t)
+                            pc = &code->_code[arg_of(w)];
+                        break;
+                    }
+                    case OpClosure: {
+                        const fntemplate& t = code->_fns[arg_of(w)];
+                        procedure_ptr p(new procedure(t._vars, t._exp, env, t._names, t._escapes, t._name));
+                        p->_code = t._code;
+                        stack.push_back(p);
+                        break;
+                    }
+                    case OpCall:
+                    case OpTailCall: {
+                    call:
+                        const size_t n = arg_of(w);
+                        auto base = stack.end() - n;
+                        if (auto l = get<builtin>(&*(base - 1))) {
+                            if (is_callcc(*l)) {
+                                if (n != 1)
+                                    throw runtime_error("bad arity");
+                                // continue with (f k), where k goes back
+                                // to where this call returns to
+                                boost::shared_ptr<continuation> k(new continuation);
+                                k->_run = self._id;
+                                k->_stack.assign(stack.begin(), base - 1);
+                                k->_frames = frames;
+                                if (op_of(w) == OpCall) {
+                                    frame f = { code, pc, env };
+                                    k->_resume = f;
+                                }
+                                else if (!frames.empty()) {
+                                    k->_resume = frames.back();
+                                    k->_frames.pop_back();
+                                }
+                                *(base - 1) = std::move(*base);
+                                *base = builtin(resume, k);
+                                goto call;
+                            }
+                            if (const continuation* k = continuation_of(*l)) {
+                                if (n != 1)
+                                    throw runtime_error("bad arity");
+                                if (k->_run != self._id && active(k->_run))
+                                    throw resumption(k->shared_from_this(), *base);
+                                // ours, or its own loop is gone: carry on here
+                                sexpr value = std::move(*base);
+                                if (!restore(*k, value))
+                                    return stack.back();
+                                break;
+                            }
+                            // builtins can't reach this stack, so it can't move under them
+                            sexpr result = (*l)(sexpr_span(&*base, n));
+                            stack.erase(base, stack.end());
+                            stack.back() = std::move(result);
+                            if (op_of(w) == OpTailCall)
+                                goto ret;
+                        }
+                        else if (auto p = get<procedure_ptr>(&*(base - 1))) {
+                            procedure_ptr proc = *p;
+                            if (!proc->_code)
+                                proc->_code = ::compile(proc->_exp);
+                            if (jit_hot(*proc->_code)) {
+                                sexprs pargs(std::make_move_iterator(base), std::make_move_iterator(stack.end()));
+                                stack.erase(base - 1, stack.end());
+                                stack.push_back(jit_apply(proc, pargs));
+                                if (op_of(w) == OpTailCall)
+                                    goto ret;
+                                break;
+                            }
+                            if (op_of(w) == OpCall) {
+                                frame f = { code, pc, env };
+                                frames.push_back(f);
+                                check_depth(frames.size());
+                            }
+                            // a tail call lets go of its own frame first, so the
+                            // callee can take its place on the frame stack
+                            env = envptr();
+                            env = make_frame(*proc, &*base, n);
+                            stack.erase(base - 1, stack.end());
+                            code = proc->_code;
+                            pc = &code->_code[0];
+                            if (profile_due)
+                                profile_sample();
+                        }
+                        else {
+                            throw runtime_error("not callable");
+                        }
+                        break;
+                    }
+                    case OpReturn:
+                    ret:
+                        if (frames.empty())
+                            return stack.back();
+                        code = std::move(frames.back()._code);
+                        pc = frames.back()._pc;
+                        env = std::move(frames.back()._env);
+                        frames.pop_back();
+                        break;
+                    default:
+                        throw runtime_error("vm: bad opcode");
+                    }
+                }
+            }
+            catch (resumption& r) {
+                if (r._k->_run != self._id && active(r._k->_run))
+                    throw;
+                if (!restore(*r._k, r._value))
+                    return stack.back();
+            }
+        }
+    }
+}
+
+bytecode::~bytecode() {
+    jit_release(*this);
+}
+
+bytecode_ptr compile(const sexpr& x) {
+    bytecode_ptr bc(new bytecode);
+    compiler(*bc).compile(x, true);
+    return bc;
+}
+
+sexpr callcc(sexpr_span args) {
+    if (args.size() != 1)
+        throw runtime_error("bad arity");
+    // (call/cc f) in a tail position, as the whole of a new loop
+    bytecode_ptr bc(new bytecode);
+    bc->_consts.push_back(builtin(callcc));
+    bc->_consts.push_back(args[0]);
+    bc->_code.push_back(OpConst | (0 << 8));
+    bc->_code.push_back(OpConst | (1 << 8));
+    bc->_code.push_back(OpTailCall | (1 << 8));
+    return run(bc, global_env());
+}
+
+const continuation* continuation_of(const builtin& fn) {
+    if (fn._arity == builtin::Bound && fn._fn.bf == resume)
+        return (const continuation*)fn._data.get();
+    return nullptr;
+}
+
+sexpr vm_eval(const sexpr& x, const envptr& env) {
+    return run(compile(x), env);
+}
+
+sexpr vm_apply(const procedure_ptr& proc, sexprs& args) {
+    if (!proc->_code)
+        proc->_code = compile(proc->_exp);
+    if (jit_hot(*proc->_code))
+        return jit_apply(proc, args);
+    envptr env = make_frame(*proc, args.data(), args.size());
+    return run(proc->_code, env);
+}
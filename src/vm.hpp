@@ -0,0 +1,92 @@
+#pragma once
+
+// a bytecode compiler and stack vm for resolved scheme code,
+// selected with --engine=vm as an alternative to eval()
+
+#include "scheme.hpp"
+#include <boost/enable_shared_from_this.hpp>
+#include <stdint.h>
+
+// each instruction is one 32 bit word: the low 8 bits are the
+// opcode and the high 24 bits its argument, which the frame
+// access instructions split into depth (8 bits) and slot (16 bits)
+enum opcode {
+    OpConst,      // push consts[arg]
+    OpLocal,      // push slot of the frame depth levels up
+    OpGlobal,     // push the global bound to the globalref consts[arg]
+    OpName,       // push the variable named consts[arg] (unresolved code)
+    OpSetLocal,   // pop into slot of the frame depth levels up
+    OpSetGlobal,  // pop into the existing global bound to consts[arg]
+    OpSetName,    // pop into the existing variable named consts[arg]
+    OpDefName,    // pop into a binding named consts[arg] in the current frame
+    OpPop,
+    OpJump,       // continue at arg
+    OpJumpIfNot,  // pop, continue at arg if false
+    OpClosure,    // push a procedure for fns[arg] closing over the current frame
+    OpCall,       // call with arg arguments, the callee is below them
+    OpTailCall,   // as OpCall, replacing the current frame
+    OpReturn,
+};
+
+inline uint32_t op_of(uint32_t w) { return w & 0xff; }
+inline uint32_t arg_of(uint32_t w) { return w >> 8; }
+inline uint32_t frame_depth(uint32_t w) { return (w >> 8) & 0xff; }
+inline uint32_t frame_slot(uint32_t w) { return w >> 16; }
+
+// a fn expression as seen by OpClosure
+struct fntemplate {
+    fntemplate() : _escapes(true), _name(SymFn) {}
+    sexpr_list _vars;
+    sexpr_list _names;
+    sexpr _exp;
+    bool _escapes;
+    symbol _name;
+    bytecode_ptr _code;
+};
+
+struct jitctx;
+typedef int (*native_fn)(jitctx*);
+
+struct bytecode {
+    bytecode() : _calls(0), _native(nullptr), _native_size(0) {}
+    ~bytecode();
+    std::vector<uint32_t> _code;
+    sexprs _consts;
+    std::vector<fntemplate> _fns;
+    unsigned _calls;      // calls so far, counted until the jit kicks in
+    native_fn _native;    // machine code for _code, see jit.cpp
+    size_t _native_size;
+};
+
+// a return point: the code to carry on in and its frame
+struct frame {
+    bytecode_ptr _code;
+    const uint32_t* _pc;
+    envptr _env;
+};
+
+// a continuation captured by call/cc: a copy of the control stack of
+// the vm loop it was captured in, which it can be resumed in any
+// number of times. the vm keeps that stack on the heap, so capturing
+// and resuming are plain copies with no unwinding
+struct continuation : public boost::enable_shared_from_this<continuation> {
+    unsigned _run;          // which activation of the vm loop it belongs to
+    sexprs _stack;
+    std::vector<frame> _frames;
+    frame _resume;          // where to carry on, no code to return from the loop
+};
+
+// compile a resolved top level form or procedure body
+bytecode_ptr compile(const sexpr& x);
+
+// call/cc, as seen by callers outside the vm, which runs the
+// procedure in a vm loop of its own. its continuation goes no
+// further than that loop, so it can only escape from code that
+// isn't run by the vm, like the tree walker
+sexpr callcc(sexpr_span args);
+
+// the continuation a builtin resumes, or null
+const continuation* continuation_of(const builtin& fn);
+
+sexpr vm_eval(const sexpr& x, const envptr& env);
+sexpr vm_apply(const procedure_ptr& proc, sexprs& args);